@@ -78,6 +78,8 @@ static int make_dual(void);
 
 void init_plugin(){
     qswitch = TRUE;
+    //we need the automorphism group of each quadrangulation
+    Gswitch = TRUE;
 }
 
 
@@ -144,6 +146,111 @@ item* increment(item* head, int key){
 
 //////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Symmetry breaking with the automorphism group computed by plantri. For
+ * 0 <= k < nbtot the edge numbering[0][i] is mapped to numbering[k][i] by an
+ * automorphism, and the first nbop numberings are orientation preserving (all
+ * of them if nbop is 0). A perfect matching is only handled if its edges give
+ * the lexicographically largest vector in numbering[0] over all numberings. An
+ * angle assignment for that matching is only handled if its vector of angles
+ * is the largest over the automorphisms that fix the matching, combined with
+ * the exchange of alpha and delta and of beta and gamma. With -o only the
+ * orientation preserving automorphisms are used. Nothing of this is done for
+ * quadrangulations with a trivial group.
+ */
+
+int automorphismCount = 1; //the automorphisms that are used
+int orientationPreservingAutomorphismCount = 1;
+
+int matchingStabiliser[2*MAXE];
+int matchingStabiliserSize = 0;
+
+int isMatchingEdge[NUMEDGES];
+
+/*
+ * The angle in the corner between e and e->next for each edge e: 0 for alpha,
+ * 1 for beta, 2 for gamma and 3 for delta.
+ */
+int angleInCorner[NUMEDGES];
+
+unsigned long long int matchingsRejectedBySymmetry = 0;
+unsigned long long int assignmentsRejectedBySymmetry = 0;
+
+int isCanonicalPerfectMatching(){
+    int i, k;
+    EDGE **nb0 = (EDGE**)numbering[0];
+    
+    for(i=0; i<ne; i++){
+        isMatchingEdge[nb0[i] - edges] = FALSE;
+    }
+    for(i=0; i<nv-2; i++){
+        isMatchingEdge[matchingEdges[i] - edges] = TRUE;
+        isMatchingEdge[matchingEdges[i]->invers - edges] = TRUE;
+    }
+    
+    matchingStabiliserSize = 0;
+    for(k=1; k<automorphismCount; k++){
+        EDGE **nb = (EDGE**)numbering[k];
+        for(i=0; i<ne && isMatchingEdge[nb[i] - edges]==isMatchingEdge[nb0[i] - edges]; i++);
+        if(i==ne){
+            matchingStabiliser[matchingStabiliserSize++] = k;
+        } else if(isMatchingEdge[nb[i] - edges]){
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Returns a positive value if the image of the current angle assignment under
+ * the automorphism given by numbering[k] is larger than the angle assignment,
+ * 0 if they are equal and a negative value otherwise. If exchangeAngles is
+ * TRUE, then alpha and delta and beta and gamma are exchanged in the image.
+ */
+int compareImageOfAngleAssignment(int k, int exchangeAngles){
+    int i;
+    EDGE **nb0 = (EDGE**)numbering[0];
+    EDGE **nb = (EDGE**)numbering[k];
+    int isOrientationReversing = k >= orientationPreservingAutomorphismCount;
+    
+    for(i=0; i<ne; i++){
+        int angle = angleInCorner[(isOrientationReversing ? nb[i]->prev : nb[i]) - edges];
+        if(exchangeAngles){
+            angle = 3 - angle;
+        }
+        if(angle != angleInCorner[nb0[i] - edges]){
+            return angle - angleInCorner[nb0[i] - edges];
+        }
+    }
+    return 0;
+}
+
+int isCanonicalAngleAssignment(){
+    int i, j;
+    
+    for(i=0; i<nv-2; i++){
+        EDGE *e = matchingEdges[i];
+        for(j=0; j<4; j++){
+            //the corner at e->end
+            e = e->invers->prev;
+            angleInCorner[e - edges] = angleAssigmentDirection[i] ? j : 3 - j;
+        }
+    }
+    
+    if(compareImageOfAngleAssignment(0, TRUE) > 0){
+        return FALSE;
+    }
+    for(i=0; i<matchingStabiliserSize; i++){
+        if(compareImageOfAngleAssignment(matchingStabiliser[i], FALSE) > 0 ||
+                compareImageOfAngleAssignment(matchingStabiliser[i], TRUE) > 0){
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 void handleSolution(){
     
 }
@@ -368,6 +475,10 @@ int firstCheckOfSystem(){
 }
 
 void handleAngleAssignment(){
+    if(matchingStabiliserSize > 0 && !isCanonicalAngleAssignment()){
+        assignmentsRejectedBySymmetry++;
+        return;
+    }
     assignmentCount++;
     createSystem();
     if(firstCheckOfSystem()){
@@ -397,15 +508,24 @@ void assignAnglesForCurrentPerfectMatchingRecursion(int currentFace){
 }    
 
 void assignAnglesForCurrentPerfectMatching(){
-    //we fix the direction of one face to prevent mirror images to both be generated.
-    angleAssigmentDirection[0] = 0;
-    assignAnglesForCurrentPerfectMatchingRecursion(1);
+    if(matchingStabiliserSize > 0){
+        //the mirror images are rejected by isCanonicalAngleAssignment()
+        assignAnglesForCurrentPerfectMatchingRecursion(0);
+    } else {
+        //we fix the direction of one face to prevent mirror images to both be generated.
+        angleAssigmentDirection[0] = 0;
+        assignAnglesForCurrentPerfectMatchingRecursion(1);
+    }
 }
 
 int matchingCount = 0;
 
 void handlePerfectMatching(){
     matchingCount++;
+    if(automorphismCount > 1 && !isCanonicalPerfectMatching()){
+        matchingsRejectedBySymmetry++;
+        return;
+    }
     assignAnglesForCurrentPerfectMatching();
 }
 
@@ -456,6 +576,10 @@ static int generate_perfect_matchings_in_dual(int nbtot, int nbop, int doflip) {
     
     matchingCount = 0;
     
+    orientationPreservingAutomorphismCount = (nbop==0 ? nbtot : nbop);
+    automorphismCount = (oswitch ? orientationPreservingAutomorphismCount : nbtot);
+    matchingStabiliserSize = 0;
+    
     unsigned long long int oldSolutionCount = solvable;
     
     //we need the dual graph
@@ -527,6 +651,8 @@ void perfect_matchings_summary() {
     fprintf(stderr, "\n%llu quadrangulations don't correspond to a tiling.\n", unusedGraphCount);
     if(printStatistics){
         fprintf(stderr, "\nRejected by Hamming distance: %llu\n", rejectedByHammingDistance);
-        fprintf(stderr, "Rejected by lpsolve: %llu\n\n", assignmentCount - solvable - rejectedByHammingDistance);
+        fprintf(stderr, "Rejected by lpsolve: %llu\n", assignmentCount - solvable - rejectedByHammingDistance);
+        fprintf(stderr, "Matchings rejected by symmetry: %llu\n", matchingsRejectedBySymmetry);
+        fprintf(stderr, "Assignments rejected by symmetry: %llu\n\n", assignmentsRejectedBySymmetry);
     }
 }
\ No newline at end of file
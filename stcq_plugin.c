@@ -0,0 +1,155 @@
+/* PLUGIN file to use with plantri.c
+
+   To use this, compile plantri.c together with stcq_sa.c using
+       cc -o plantri_stcq_sa -O4 -pthread '-DPLUGIN="stcq_plugin.c"' -DPLANTRI_PLUGIN plantri.c stcq_sa.c
+
+   This plug-in hands each quadrangulation generated by plantri directly to
+   the search of stcq_sa.c, so the quadrangulations are not written as planar
+   code and read again. The options of stcq are given as one argument of the
+   switch -S, e.g.
+       plantri_stcq_sa -q -u 16 "-S-s --interleaved -j 4"
+   Use -u, since the quadrangulations are output by stcq (--usedquadrangulations
+   and --unusedquadrangulations) and not by plantri.
+
+   Quadrangulations with a cubic quadrangle (a face with four vertices of
+   degree 3) are rejected on plantri's embedding, before they are passed to
+   stcq. By default this is done in FILTER, so after plantri's canonicity test,
+   and these quadrangulations are counted as unused in stcq's summary. With
+   the switch -C the test is already done in FAST_FILTER_QUAD, before the
+   canonicity test of each extension to the final number of vertices. This
+   saves canon() for these quadrangulations, but then they are not counted by
+   stcq and not numbered for its selection options (e.g. --range). Smaller
+   extensions are always accepted, since their descendants can still admit a
+   tiling.
+*/
+
+#define FILTER handle_quadrangulation_in_stcq
+#define PLUGIN_INIT init_stcq_plugin()
+#define SUMMARY summary_stcq_plugin
+#define FAST_FILTER_QUAD (nv < maxnv || nv <= 8 || !rejectCubicQuadranglesEarly ||\
+                          !(canRejectCubicQuadrangles() && has_cubic_quadrangle()))
+#define HELPMESSAGE fprintf(stderr, "Use \"-S<options>\" to pass options to stcq (-S-h lists them).\n");\
+                    fprintf(stderr, "Use -C to reject cubic quadrangles before the canonicity test.\n")
+#define PLUGIN_SWITCHES else if(arg[j]=='S'){\
+                            stcqOptions = arg + j + 1;\
+                            j = strlen(arg) - 1;\
+                        }\
+                        else if(arg[j]=='C'){\
+                            rejectCubicQuadranglesEarly = TRUE;\
+                        }
+
+#define MAXSTCQOPTIONS 100
+
+void startPlugin(int argc, char *argv[]);
+void handlePluginQuadrangulation(int vertexCount, int *degrees, int *ends, int *inverses);
+int canRejectCubicQuadrangles();
+void rejectPluginQuadrangulation(int vertexCount);
+void finishPlugin();
+
+static char *stcqOptions = NULL; /* the options for stcq given with -S */
+static int rejectCubicQuadranglesEarly = FALSE; /* -C */
+
+static int stcqEdgeNumber[NUMEDGES]; /* the number of each edge for stcq */
+
+void init_stcq_plugin(){
+    static char options[1000];
+    char *argv[MAXSTCQOPTIONS];
+    int argc = 0;
+
+    qswitch = TRUE;
+
+    argv[argc++] = cmdname;
+    if(stcqOptions != NULL){
+        if(strlen(stcqOptions) >= sizeof(options)){
+            fprintf(stderr, ">E %s: the options for stcq are too long\n", cmdname);
+            exit(1);
+        }
+        strcpy(options, stcqOptions);
+        char *option = strtok(options, " \t");
+        while(option != NULL){
+            if(argc == MAXSTCQOPTIONS - 1){
+                fprintf(stderr, ">E %s: too many options for stcq\n", cmdname);
+                exit(1);
+            }
+            argv[argc++] = option;
+            option = strtok(NULL, " \t");
+        }
+    }
+    argv[argc] = NULL;
+    startPlugin(argc, argv);
+}
+
+/* Returns TRUE if the quadrangulation has a face of which all four vertices
+   have degree 3. */
+static int has_cubic_quadrangle() {
+    EDGE *e, *elast, *ef;
+    int i, k;
+
+    for(i = 0; i < nv; i++){
+        if(degree[i] != 3) continue;
+        e = elast = firstedge[i];
+        do {
+            ef = e;
+            for(k = 0; k < 4 && degree[ef->start] == 3; k++){
+                ef = ef->invers->prev;
+            }
+            if(k == 4) return TRUE;
+            e = e->next;
+        } while(e != elast);
+    }
+    return FALSE;
+}
+
+/* Numbers the vertices in a breadth first manner, in the same way as the
+   planar code written by plantri, and passes the edges to stcq. */
+static int handle_quadrangulation_in_stcq(int nbtot, int nbop, int doflip) {
+    EDGE *startedge[MAXN], *e, *elast;
+    int number[MAXN];
+    int degrees[MAXN], ends[MAXE], inverses[MAXE];
+    int i, vertexCount, edgeCount;
+
+    //the cube is the only quadrangulation with a cubic quadrangle that is used
+    if(nv > 8 && canRejectCubicQuadrangles() && has_cubic_quadrangle()){
+        rejectPluginQuadrangulation(nv);
+        return 0;
+    }
+
+    for(i = 0; i < nv; i++) number[i] = -1;
+    number[firstedge[0]->start] = 0;
+    startedge[0] = firstedge[0];
+    vertexCount = 1;
+
+    edgeCount = 0;
+    for(i = 0; i < nv; i++){
+        degrees[i] = 0;
+        e = elast = startedge[i];
+        do {
+            if(number[e->end] < 0){
+                number[e->end] = vertexCount;
+                startedge[vertexCount++] = e->invers;
+            }
+            ends[edgeCount] = number[e->end];
+            stcqEdgeNumber[e - edges] = edgeCount++;
+            degrees[i]++;
+            e = e->next;
+        } while(e != elast);
+    }
+
+    edgeCount = 0;
+    for(i = 0; i < nv; i++){
+        e = elast = startedge[i];
+        do {
+            inverses[edgeCount++] = stcqEdgeNumber[e->invers - edges];
+            e = e->next;
+        } while(e != elast);
+    }
+
+    handlePluginQuadrangulation(nv, degrees, ends, inverses);
+
+    //the output is written by stcq
+    return 0;
+}
+
+void summary_stcq_plugin() {
+    finishPlugin();
+}
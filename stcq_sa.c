@@ -6,19 +6,23 @@
  * 
  * Compile with:
  *     
- *     cc -o stcq -O4 stcq_sa.c liblpsolve55.a
- * 
- * On some systems it might be necessary to compile with:
- *     
- *     cc -o stcq -O4 stcq_sa.c liblpsolve55.a -lm -ldl -lssp
+ *     cc -o stcq -O4 -pthread stcq_sa.c
  * 
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <getopt.h>
-
-#include "lp_lib.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
 
 #ifndef MAXN
 #define MAXN 64            /* the maximum number of vertices */
@@ -30,6 +34,23 @@
 
 #define INFI (MAXN + 1)
 
+/* Everything that describes the current quadrangulation or the current state
+ * of the search is thread-local, so that each worker thread (see -j) has its
+ * own copy.
+ */
+#define THREAD_LOCAL __thread
+
+/* Hook for the tests that need a process that is killed at a point that cannot
+ * be reached from outside (see tests/persistent_cache.sh). When compiled with
+ * -DTEST_KILL_AT=n, TEST_KILL_HOOK(count) kills the process when count is n.
+ * Otherwise it does nothing.
+ */
+#ifdef TEST_KILL_AT
+#define TEST_KILL_HOOK(count) do { if ((count) == TEST_KILL_AT) raise(SIGKILL); } while (0)
+#else
+#define TEST_KILL_HOOK(count)
+#endif
+
 #undef FALSE
 #undef TRUE
 #define FALSE 0
@@ -45,8 +66,7 @@ typedef struct e /* The data type used for edges */ {
     struct e *prev; /* previous edge in clockwise direction */
     struct e *next; /* next edge in clockwise direction */
     struct e *inverse; /* the edge that is inverse to this one */
-    int mark,index;    /* two ints for temporary use;
-                          Only access mark via the MARK macros. */
+    int index;    /* int for temporary use */
 
     int left_facesize; /* size of the face in prev-direction of the edge.
         		  Only used for -p option. */
@@ -55,36 +75,68 @@ typedef struct e /* The data type used for edges */ {
     int allowedInFaceMatching;
 } EDGE;
 
-EDGE *firstedge[MAXN]; /* pointer to arbitrary edge out of vertex i. */
-int degree[MAXN];
+THREAD_LOCAL EDGE *firstedge[MAXN]; /* pointer to arbitrary edge out of vertex i. */
+THREAD_LOCAL int degree[MAXN];
 
-EDGE *facestart[MAXF]; /* pointer to arbitrary edge of face i. */
-int faceSize[MAXF]; /* pointer to arbitrary edge of face i. */
-
-EDGE edges[MAXE];
-
-static int markvalue = 30000;
-#define RESETMARKS {int mki; if ((markvalue += 2) > 30000) \
-       { markvalue = 2; for (mki=0;mki<MAXE;++mki) edges[mki].mark=0;}}
-#define MARK(e) (e)->mark = markvalue
-#define MARKLO(e) (e)->mark = markvalue
-#define MARKHI(e) (e)->mark = markvalue+1
-#define UNMARK(e) (e)->mark = markvalue-1
-#define ISMARKED(e) ((e)->mark >= markvalue)
-#define ISMARKEDLO(e) ((e)->mark == markvalue)
-#define ISMARKEDHI(e) ((e)->mark > markvalue)
+THREAD_LOCAL EDGE *facestart[MAXF]; /* pointer to arbitrary edge of face i. */
+THREAD_LOCAL int faceSize[MAXF]; /* pointer to arbitrary edge of face i. */
 
+THREAD_LOCAL EDGE edges[MAXE];
 
 unsigned long long int numberOfQuadrangulations = 0;
-unsigned long long int rejectedByCoefficientDiff = 0;
+THREAD_LOCAL unsigned long long int rejectedByCoefficientDiff = 0;
 
 boolean printDuplicateEquations = FALSE;
 
-unsigned long long int filterOnly = 0;
+int threadCount = 1;
+
+int splitDepth = 0; //with -j: split the search of each quadrangulation at this depth
+
+/* With --res and --mod only a share of the work is done: either the
+ * quadrangulations with (number - 1) % mod == res, or, when a split depth is
+ * given, the subtrees at that depth with (number + index) % mod == res, where
+ * index is the index of the subtree in the search of the quadrangulation.
+ */
+unsigned long long int partitionResidue = 0;
+unsigned long long int partitionModulus = 1;
+
+/* With --blocks the input is split in partitionModulus blocks of consecutive
+ * quadrangulations, and share res consists of the quadrangulations in block
+ * res. The number of quadrangulations is taken from the offset index.
+ */
+boolean isBlockPartition = FALSE;
+
+//serializes the numbering of the LaTeX files of the worker threads
+pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+//the number of solutions that were output, used to number the LaTeX files
+unsigned long long int outputSolutionCount = 0;
+
+/* With -f only the quadrangulations in these ranges are handled. The ranges
+ * are sorted and disjoint.
+ */
+typedef struct {
+    unsigned long long int first;
+    unsigned long long int last;
+} FILTER_RANGE;
+
+FILTER_RANGE *filterRanges = NULL;
+int filterRangeCount = 0;
+char *filterDescription = NULL; //the ranges as they are written in the summary
+
+char *summaryFileName = NULL; //file for the machine-readable summary
+
+//the number of vertices of the input quadrangulations, or -1 if it varies
+int inputVertexCount = 0;
 
 boolean onlyConvex = TRUE;
 
 char outputFormat = 'n'; //defaults to no output
+char angleValueFormat = 'n'; //the angle values written after each angle assignment with -o c
+char *outputFileName = NULL; //the file that replaces stdout
+FILE *humanOutputFile = NULL; //stdout, or stderr if stdout contains code
+
+#define OUTPUT_BUFFER_SIZE (1024*1024)
 
 char generatedType = 't'; //defaults to spherical tilings
 
@@ -95,46 +147,78 @@ boolean outputSolution = TRUE; //by default we output the solution
 
 boolean isEarlyFilteringEnabled = TRUE;
 boolean generateAllMatchings = FALSE;
+boolean interleavedSearch = FALSE; //decide the matching and the directions together
 boolean boundAngleAssignments = TRUE;
 
 boolean printUnsolvableSystems = FALSE; //1
 boolean printStatistics = FALSE; //2
 
-boolean writeLpsolveUnsolvedSystems = FALSE; //1
+boolean writeUnsolvedSystems = FALSE; //1
 boolean writeHammingDistanceUnsolvedSystems = FALSE; //2
 
 boolean oneBased = FALSE;
 
 boolean includeGroup = FALSE;
 
+char *latexFileName = NULL;
 FILE *latexSummaryFile = NULL;
 boolean latexPerSolution = FALSE;
 char *latexBaseName = NULL;
 char latexFileNameBuffer[100];
 
-boolean matched[MAXF];
-int match[MAXF];
-EDGE *matchingEdges[MAXF];
+THREAD_LOCAL boolean matched[MAXF];
+THREAD_LOCAL int match[MAXF];
+THREAD_LOCAL EDGE *matchingEdges[MAXF];
+
+#define ANGLE_COUNT 4
+
+typedef long long int COEFFICIENT;
+
+typedef struct {
+    COEFFICIENT num;
+    COEFFICIENT den; //always positive
+} RATIONAL;
+
+THREAD_LOCAL RATIONAL angleValues[ANGLE_COUNT]; //solution of the last feasible system
+
+/* The equation of each vertex is stored in a single word with one byte for
+ * the number of times each angle occurs at that vertex. The maximum degree is
+ * less than 256, so the counts never overflow into the next byte.
+ */
+typedef unsigned int PACKED_EQUATION;
+
+#define PACK_EQUATION(a, b, c, d) \
+    (((PACKED_EQUATION)(a) << 24) | ((PACKED_EQUATION)(b) << 16) | \
+     ((PACKED_EQUATION)(c) << 8) | (PACKED_EQUATION)(d))
+
+#define ALPHA_UNIT (1u << 24)
+#define BETA_UNIT (1u << 16)
+#define GAMMA_UNIT (1u << 8)
+#define DELTA_UNIT 1u
+
+THREAD_LOCAL PACKED_EQUATION vertexEquation[MAXN];
 
-int alphaCount[MAXN];
-int betaCount[MAXN];
-int gammaCount[MAXN];
-int deltaCount[MAXN];
+#define alphaCount(v) ((int) (vertexEquation[v] >> 24))
+#define betaCount(v) ((int) ((vertexEquation[v] >> 16) & 0xFF))
+#define gammaCount(v) ((int) ((vertexEquation[v] >> 8) & 0xFF))
+#define deltaCount(v) ((int) (vertexEquation[v] & 0xFF))
 
-boolean isDuplicateEquation[MAXN];
-int duplicateEquationCount = 0;
+THREAD_LOCAL boolean isDuplicateEquation[MAXN];
+THREAD_LOCAL int duplicateEquationCount = 0;
 
-int degreeThreeVertexTypes[MAXN];
+THREAD_LOCAL int degreeThreeVertexTypes[MAXN];
 
-int nv; //the number of vertices of the current quadrangulation
-int nf; //the number of faces of the current quadrangulation
-int ne; //the number of edges of the current quadrangulation
+THREAD_LOCAL int nv; //the number of vertices of the current quadrangulation
+THREAD_LOCAL int nf; //the number of faces of the current quadrangulation
+THREAD_LOCAL int ne; //the number of edges of the current quadrangulation
 
-int orderedFaces[MAXF];
-int faceRank[MAXF]; //inverse of orderedFaces
-boolean checkVerticesAfterFace[MAXF]; //if true for index i, then the vertex restriction
-                                  //should be tested after i faces have been assigned
-boolean vertexCompletedAfterFace[MAXN];
+THREAD_LOCAL int orderedFaces[MAXF];
+THREAD_LOCAL int faceRank[MAXF]; //inverse of orderedFaces
+THREAD_LOCAL int vertexCompletedAfterFace[MAXN]; //index in orderedFaces of the last face at the vertex
+THREAD_LOCAL int completedVertices[MAXN]; //the vertices sorted by vertexCompletedAfterFace
+THREAD_LOCAL int completedVerticesStart[MAXF + 1]; //the vertices completed by the face at index i
+                                      //are stored at positions completedVerticesStart[i]
+                                      //up to completedVerticesStart[i+1]
 
 /*
  * The following variable stores the direction in which the edges of the face
@@ -143,22 +227,59 @@ boolean vertexCompletedAfterFace[MAXN];
  * 
  * Possible directions are 0 and 1.
  */
-int angleAssigmentDirection[MAXF];
+THREAD_LOCAL int angleAssigmentDirection[MAXF];
 
-char angleAroundVertex[MAXN][MAXN];
+THREAD_LOCAL boolean faceDecided[MAXF]; //TRUE if the angles of the face are fixed
 
-unsigned long long int unusedGraphCount = 0;
+THREAD_LOCAL char angleAroundVertex[MAXN][MAXN];
 
-unsigned long long int solvable = 0;
+THREAD_LOCAL unsigned long long int unusedGraphCount = 0;
 
-unsigned long long int solvableAndCanonical = 0;
+THREAD_LOCAL unsigned long long int solvable = 0;
 
-int quadrangulationAutomorphisms[4*MAXE][MAXN]; //there are at most 4e automorphisms
-int quadrangulationAutomorphismsCount;
+THREAD_LOCAL unsigned long long int solvableAndCanonical = 0;
 
-int aaAutomorphisms[4*MAXE][MAXN]; //there are at most 4e automorphisms
-int aaAutomorphismsCount;
-boolean aaAutomorphismGroupContainsOrientationReversingSymmetry;
+THREAD_LOCAL int quadrangulationAutomorphisms[4*MAXE][MAXN]; //there are at most 4e automorphisms
+THREAD_LOCAL int quadrangulationAutomorphismsCount;
+
+/*
+ * The automorphisms of the quadrangulation as edge permutations. Position j
+ * corresponds to the j-th edge in quadrangulationCertificateEdges (the edges
+ * around vertex 0, 1, ... starting at firstedge and following next). The
+ * entry at position j is the index of the edge whose angle ends up at that
+ * position under the automorphism. For orientation-reversing automorphisms
+ * this already accounts for the angles being read in the prev-direction.
+ */
+THREAD_LOCAL int quadrangulationAutomorphismEdges[4*MAXE][MAXE];
+THREAD_LOCAL int quadrangulationCertificateEdges[MAXE];
+
+/*
+ * The faces containing the angles in the arrays above, i.e., the right faces
+ * of those edges. Used to decide which angles are already fixed during the
+ * search.
+ */
+THREAD_LOCAL int quadrangulationAutomorphismFaces[4*MAXE][MAXE];
+THREAD_LOCAL int quadrangulationCertificateFaces[MAXE];
+
+/*
+ * The relabelling of the angles by the symmetry of the quadrangle:
+ * alpha <-> delta and beta <-> gamma, or alpha <-> gamma for STCQ4.
+ */
+const char relabelledAngle[2][4] = {{3, 2, 1, 0}, {2, 1, 0, 3}};
+
+/*
+ * The position in the certificate of the first angle of the face that is
+ * decided first (orderedFaces[0]). Of an angle assignment and its relabelled
+ * image only the one that has the smaller angle at this position can be
+ * canonical, so the direction of this face can be fixed.
+ */
+THREAD_LOCAL int rootAnglePosition;
+
+boolean breakSymmetry = TRUE; //prune non-canonical partial angle assignments
+
+THREAD_LOCAL int aaAutomorphisms[4*MAXE][MAXN]; //there are at most 4e automorphisms
+THREAD_LOCAL int aaAutomorphismsCount;
+THREAD_LOCAL boolean aaAutomorphismGroupContainsOrientationReversingSymmetry;
 
 boolean generateSTCQ4 = FALSE;
 
@@ -193,7 +314,7 @@ int degreeThreeTypesCombinationVertexLowerBound[10][10] =
     {INFI,   10,    0,   10, INFI,    8, INFI, INFI, INFI,    0},
     {   0,    0,   10,    0, INFI, INFI,    0, INFI, INFI, INFI},
     {   0,    0, INFI, INFI,    0,   10, INFI,    0, INFI, INFI},
-    {INFI, INFI,   10, INFI,   10,    0, INFI, INFI,    0,    0},
+    {INFI, INFI,    8, INFI,   10,    0, INFI, INFI,    0,    0},
     {INFI, INFI, INFI,    0, INFI, INFI,    0,   10,    0,    0},
     {   8, INFI, INFI, INFI,    0, INFI,   10,    0,   10, INFI},
     {INFI,    0, INFI, INFI, INFI,    0,    0,   10,    0, INFI},
@@ -216,10 +337,10 @@ int degreeThreeTypesCombinationVertexUpperBound[10][10] =
 
 int getDegreeThreeVertexType(int v){
     int a, b, c, d;
-    a = alphaCount[v];
-    b = betaCount[v];
-    c = gammaCount[v];
-    d = deltaCount[v];
+    a = alphaCount(v);
+    b = betaCount(v);
+    c = gammaCount(v);
+    d = deltaCount(v);
     if(a+b+c+d!=3){
         fprintf(stderr, "Something went wrong. :-(\n");
         exit(0);
@@ -249,6 +370,309 @@ int getDegreeThreeVertexType(int v){
 
 //////////////////////////////////////////////////////////////////////////////
 
+/* With -j or --procs the output of a quadrangulation is collected in output
+ * chunks, so that it can be written in the order of the input. Each stream
+ * of a chunk is kept in memory, until it gets larger than OUTPUT_CHUNK_LIMIT.
+ * Then its contents are appended to the spill file, which is shared by all
+ * chunks, and the chunk keeps the position and length of these segments.
+ * Without a current chunk, the output is written directly.
+ *
+ * With --latex-per-solution the LaTeX stream contains the solutions separated
+ * by '\0'. They are split into separate files when they are written, so that
+ * the files are numbered in the order of the input.
+ */
+
+#define CODE_OUTPUT 0 //stdout
+#define HUMAN_OUTPUT 1 //humanOutputFile
+#define LATEX_OUTPUT 2 //latexSummaryFile
+#define OUTPUT_STREAMS 3
+
+#define OUTPUT_CHUNK_LIMIT (1024*1024)
+
+typedef struct output_segment {
+    off_t offset; //the position in the spill file
+    size_t length;
+    struct output_segment *next;
+} OUTPUT_SEGMENT;
+
+typedef struct output_chunk {
+    int index; //the position of the chunk in the output of the quadrangulation
+    FILE *streams[OUTPUT_STREAMS]; //NULL if nothing is kept in memory for the stream
+    char *buffers[OUTPUT_STREAMS];
+    size_t sizes[OUTPUT_STREAMS];
+    OUTPUT_SEGMENT *spilledSegments[OUTPUT_STREAMS]; //the output that comes before the buffer
+    OUTPUT_SEGMENT *lastSpilledSegments[OUTPUT_STREAMS];
+    size_t spilledSizes[OUTPUT_STREAMS];
+    char *codeHeader; //the header of the code in the chunk
+    struct output_chunk *next;
+} OUTPUT_CHUNK;
+
+THREAD_LOCAL OUTPUT_CHUNK *currentOutputChunk = NULL;
+
+int spillFile = -1;
+off_t spillFileEnd = 0;
+size_t spilledBytes = 0; //the bytes in the spill file that are not written yet
+pthread_mutex_t spillFileLock = PTHREAD_MUTEX_INITIALIZER;
+
+char *codeHeader = NULL; //the header of the code that is written to stdout
+boolean codeHeaderWritten = FALSE;
+
+boolean latexSolutionStarted = FALSE; //the last solution is not completely written
+FILE *latexSolutionFile = NULL; //NULL if the file of that solution could not be created
+
+OUTPUT_CHUNK *newOutputChunk(int index){
+    OUTPUT_CHUNK *chunk = (OUTPUT_CHUNK *) calloc(1, sizeof(OUTPUT_CHUNK));
+    if(chunk == NULL){
+        fprintf(stderr, "Insufficient memory for output -- exiting!\n");
+        exit(1);
+    }
+    chunk->index = index;
+    return chunk;
+}
+
+FILE *outputStream(int type){
+    if(currentOutputChunk == NULL){
+        return type == CODE_OUTPUT ? stdout : (type == HUMAN_OUTPUT ? humanOutputFile : latexSummaryFile);
+    }
+    if(currentOutputChunk->streams[type] == NULL){
+        currentOutputChunk->streams[type] = open_memstream(
+                currentOutputChunk->buffers + type, currentOutputChunk->sizes + type);
+        if(currentOutputChunk->streams[type] == NULL){
+            fprintf(stderr, "Insufficient memory for output -- exiting!\n");
+            exit(1);
+        }
+    }
+    return currentOutputChunk->streams[type];
+}
+
+void writeCodeHeader(char *header){
+    if(currentOutputChunk != NULL){
+        currentOutputChunk->codeHeader = header;
+    } else {
+        codeHeader = header;
+        if(!codeHeaderWritten){
+            fprintf(stdout, "%s", header);
+            codeHeaderWritten = TRUE;
+        }
+    }
+}
+
+/* Creates the separate LaTeX file for the next solution. The solution is not
+ * written if the file can't be created.
+ */
+FILE *openLatexSolutionFile(){
+    if(sprintf(latexFileNameBuffer, latexBaseName, ++outputSolutionCount) <= 0){
+        fprintf(stderr, "Error creating filename for LaTeX output -- exiting!\n");
+        exit(EXIT_FAILURE);
+    }
+    return fopen(latexFileNameBuffer, "w");
+}
+
+/* Writes a part of the LaTeX stream of --latex-per-solution to the separate
+ * files. A solution can be split over several parts.
+ */
+void writeLatexPerSolution(char *data, size_t size){
+    while(size > 0){
+        if(!latexSolutionStarted){
+            latexSolutionFile = openLatexSolutionFile();
+            latexSolutionStarted = TRUE;
+        }
+        char *end = memchr(data, '\0', size);
+        size_t length = end == NULL ? size : end - data;
+        if(latexSolutionFile != NULL &&
+                fwrite(data, 1, length, latexSolutionFile) != length){
+            fprintf(stderr, "fwrite() failed -- exiting!\n");
+            exit(1);
+        }
+        if(end == NULL) return;
+        if(latexSolutionFile != NULL){
+            fclose(latexSolutionFile);
+        }
+        latexSolutionStarted = FALSE;
+        data = end + 1;
+        size -= length + 1;
+    }
+}
+
+/* Writes collected output to the target. Without a target the output is the
+ * LaTeX stream of --latex-per-solution.
+ */
+void writeCollectedOutput(char *data, size_t size, FILE *target){
+    if(target == NULL){
+        writeLatexPerSolution(data, size);
+    } else if(fwrite(data, 1, size, target) != size){
+        fprintf(stderr, "fwrite() failed -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* Returns the number of bytes of the chunk that are kept in memory.
+ */
+size_t getOutputChunkMemory(OUTPUT_CHUNK *chunk){
+    size_t size = 0;
+    int i;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(chunk->streams[i] != NULL){
+            fflush(chunk->streams[i]);
+            size += chunk->sizes[i];
+        }
+    }
+    return size;
+}
+
+/* Returns the number of bytes of the chunk that are kept in memory or in the
+ * spill file.
+ */
+size_t getOutputChunkSize(OUTPUT_CHUNK *chunk){
+    size_t size = getOutputChunkMemory(chunk);
+    int i;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        size += chunk->spilledSizes[i];
+    }
+    return size;
+}
+
+/* Appends the stream that is kept in memory to the spill file, and frees it.
+ */
+void spillOutputStream(OUTPUT_CHUNK *chunk, int type){
+    OUTPUT_SEGMENT *segment = (OUTPUT_SEGMENT *) malloc(sizeof(OUTPUT_SEGMENT));
+    size_t written = 0;
+    ssize_t size;
+    
+    if(segment == NULL){
+        fprintf(stderr, "Insufficient memory for output -- exiting!\n");
+        exit(1);
+    }
+    fclose(chunk->streams[type]);
+    
+    pthread_mutex_lock(&spillFileLock);
+    if(spillFile < 0){
+        FILE *f = tmpfile();
+        if(f == NULL){
+            fprintf(stderr, "Could not create temporary file -- exiting!\n");
+            exit(1);
+        }
+        spillFile = dup(fileno(f));
+        fclose(f);
+    }
+    segment->offset = spillFileEnd;
+    segment->length = chunk->sizes[type];
+    spillFileEnd += segment->length;
+    spilledBytes += segment->length;
+    pthread_mutex_unlock(&spillFileLock);
+    
+    while(written < segment->length){
+        size = pwrite(spillFile, chunk->buffers[type] + written,
+                segment->length - written, segment->offset + written);
+        if(size < 0 && errno != EINTR){
+            fprintf(stderr, "Could not write temporary file -- exiting!\n");
+            exit(1);
+        } else if(size > 0){
+            written += size;
+        }
+    }
+    free(chunk->buffers[type]);
+    
+    segment->next = NULL;
+    if(chunk->spilledSegments[type] == NULL){
+        chunk->spilledSegments[type] = segment;
+    } else {
+        chunk->lastSpilledSegments[type]->next = segment;
+    }
+    chunk->lastSpilledSegments[type] = segment;
+    chunk->spilledSizes[type] += segment->length;
+    chunk->streams[type] = NULL;
+    chunk->buffers[type] = NULL;
+    chunk->sizes[type] = 0;
+}
+
+void spillOutputChunk(OUTPUT_CHUNK *chunk){
+    int i;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(chunk->streams[i] != NULL){
+            spillOutputStream(chunk, i);
+        }
+    }
+}
+
+/* Copies a segment of the spill file to the target, and frees the segment.
+ * The spill file is emptied when nothing in it is waiting to be written.
+ */
+void writeSpilledSegment(OUTPUT_SEGMENT *segment, FILE *target){
+    char buffer[65536];
+    size_t copied = 0;
+    ssize_t size;
+    
+    while(copied < segment->length){
+        size_t part = segment->length - copied < sizeof(buffer) ? segment->length - copied : sizeof(buffer);
+        size = pread(spillFile, buffer, part, segment->offset + copied);
+        if(size < 0 && errno == EINTR){
+            continue;
+        } else if(size <= 0){
+            fprintf(stderr, "Could not read temporary file -- exiting!\n");
+            exit(1);
+        }
+        writeCollectedOutput(buffer, size, target);
+        copied += size;
+    }
+    
+    pthread_mutex_lock(&spillFileLock);
+    spilledBytes -= segment->length;
+    if(spilledBytes == 0){
+        if(ftruncate(spillFile, 0)){
+            fprintf(stderr, "Could not truncate temporary file -- exiting!\n");
+            exit(1);
+        }
+        spillFileEnd = 0;
+    }
+    pthread_mutex_unlock(&spillFileLock);
+    free(segment);
+}
+
+/* Moves the streams of the current chunk that became too large to the spill
+ * file.
+ */
+void limitOutputChunk(){
+    int i;
+    if(currentOutputChunk == NULL) return;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(currentOutputChunk->streams[i] != NULL){
+            fflush(currentOutputChunk->streams[i]);
+            if(currentOutputChunk->sizes[i] > OUTPUT_CHUNK_LIMIT){
+                spillOutputStream(currentOutputChunk, i);
+            }
+        }
+    }
+}
+
+/* Writes the chunk to stdout, the human-readable output and the LaTeX file,
+ * and frees it.
+ */
+void writeOutputChunk(OUTPUT_CHUNK *chunk){
+    FILE *targets[OUTPUT_STREAMS] = {stdout, humanOutputFile, latexSummaryFile};
+    int i;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(chunk->streams[i] != NULL){
+            fclose(chunk->streams[i]);
+        }
+        if(i == CODE_OUTPUT && chunk->spilledSizes[i] + chunk->sizes[i] > 0){
+            writeCodeHeader(chunk->codeHeader);
+        }
+        while(chunk->spilledSegments[i] != NULL){
+            OUTPUT_SEGMENT *segment = chunk->spilledSegments[i];
+            chunk->spilledSegments[i] = segment->next;
+            writeSpilledSegment(segment, targets[i]);
+        }
+        if(chunk->streams[i] != NULL){
+            writeCollectedOutput(chunk->buffers[i], chunk->sizes[i], targets[i]);
+            free(chunk->buffers[i]);
+        }
+    }
+    free(chunk);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 void printGroupElement(FILE *f, int *groupElement, int offset){
     int i, next;
     boolean printed[MAXN];
@@ -270,104 +694,85 @@ void printGroupElement(FILE *f, int *groupElement, int offset){
     }
 }
 
-void printPlanarGraph(){
+void printPlanarGraph(FILE *f){
     int i;
     for(i=0; i<nv; i++){
-        fprintf(stderr, "%d: ", i);
+        fprintf(f, "%d: ", i);
         EDGE *e, *elast;
     
         e = elast = firstedge[i];
         do {
-            fprintf(stderr, "%d ", e->end);
+            fprintf(f, "%d ", e->end);
             e = e->next;
         } while (e!=elast);
-        fprintf(stderr, "\n");
+        fprintf(f, "\n");
     }
 }
 
-void printAngleAssignment(){
+void printAngleAssignment(FILE *f){
     int i;
     for(i=0; i<nv; i++){
-        fprintf(stderr, "%d: ", i);
+        fprintf(f, "%d: ", i);
         EDGE *e, *elast;
     
         e = elast = firstedge[i];
         do {
-            fprintf(stderr, "%d ", e->end);
-            fprintf(stderr, "(%c) ", 'a' + e->angle);
+            fprintf(f, "%d ", e->end);
+            fprintf(f, "(%c) ", 'a' + e->angle);
             e = e->next;
         } while (e!=elast);
-        fprintf(stderr, "\n");
+        fprintf(f, "\n");
     }
-    fprintf(stderr, "\n");
+    fprintf(f, "\n");
 }
 
-void printAngleAssignmentLatex(){
-    if(latexPerSolution){
-        //open file
-        int result = sprintf(latexFileNameBuffer, latexBaseName, solvableAndCanonical);
-        if(result>0){
-           latexSummaryFile = fopen(latexFileNameBuffer, "w"); 
-        } else {
-            fprintf(stderr, "Error creating filename for LaTeX output -- exiting!\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-    
-    if(latexSummaryFile==NULL) return;
+void printAngleAssignmentLatex(FILE *f){
     int i;
     
     //start with the group
     if(includeGroup){
         calculateAutomorphismGroupAngleAssignments();
-        fprintf(latexSummaryFile, "automorphism count: %d\\\\\n", aaAutomorphismsCount);
+        fprintf(f, "automorphism count: %d\\\\\n", aaAutomorphismsCount);
         for(i=0; i<aaAutomorphismsCount; i++){
-            printGroupElement(latexSummaryFile, aaAutomorphisms[i], oneBased);
-            fprintf(latexSummaryFile, "\\\\\n");
+            printGroupElement(f, aaAutomorphisms[i], oneBased);
+            fprintf(f, "\\\\\n");
         }
     }
     
     for(i=0; i<nv; i++){
-        fprintf(latexSummaryFile, "%d: ", i + oneBased);
+        fprintf(f, "%d: ", i + oneBased);
         EDGE *e, *elast;
     
         e = elast = firstedge[i];
         do {
-            fprintf(latexSummaryFile, "%d ", e->end + oneBased);
+            fprintf(f, "%d ", e->end + oneBased);
             if(e->angle==0)
-                fprintf(latexSummaryFile, "($\\alpha$) ");
+                fprintf(f, "($\\alpha$) ");
             else if(e->angle==1)
-                fprintf(latexSummaryFile, "($\\beta$) ");
+                fprintf(f, "($\\beta$) ");
             else if(e->angle==2)
-                fprintf(latexSummaryFile, "($\\gamma$) ");
+                fprintf(f, "($\\gamma$) ");
             else// (e->angle==3)
-                fprintf(latexSummaryFile, "($\\delta$) ");
+                fprintf(f, "($\\delta$) ");
             e = e->next;
         } while (e!=elast);
-        fprintf(latexSummaryFile, "\\\\\n");
-    }
-    fprintf(latexSummaryFile, "\\\\\n");
-    
-    if(latexPerSolution){
-        fclose(latexSummaryFile);
-        latexSummaryFile = NULL;
+        fprintf(f, "\\\\\n");
     }
+    fprintf(f, "\\\\\n");
 }
 
-void printSphericalTilingByCongruentQuadrangles(lprec *lp){
-    int rows = get_Nrows(lp);
-    int cols = get_Ncolumns(lp);
-    REAL pv[1 + rows + cols];
-    get_primal_solution(lp, pv);
+void printSphericalTilingByCongruentQuadrangles(FILE *f){
     int i;
-    for(i=0; i<cols; i++){
-        fprintf(stderr, "%c = %f\n", 'a' + i, pv[1 + rows + i]);
+    for(i=0; i<ANGLE_COUNT; i++){
+        fprintf(f, "%c = %f (%lld/%lld)\n", 'a' + i,
+                (double) angleValues[i].num / angleValues[i].den,
+                angleValues[i].num, angleValues[i].den);
     }
-    printAngleAssignment();
+    printAngleAssignment(f);
 }
 
 void printFaceMatching(){
-    printPlanarGraph();
+    printPlanarGraph(stderr);
     
     int i;
     for (i = 0; i < nv - 2; i++) {
@@ -460,12 +865,13 @@ void computeAngleAssignmentCodeShort(unsigned short code[], int *length) {
     return;
 }
 
-void writeAngleAssignment(){
-    static boolean first = TRUE;
-    
-    if(first){
-        fprintf(stdout, ">>angle_assignment<<");
-        first = FALSE;
+void writeAngleAssignment(FILE *f){
+    if(angleValueFormat == 'r'){
+        writeCodeHeader(">>angle_assignment rational<<");
+    } else if(angleValueFormat == 'd'){
+        writeCodeHeader(">>angle_assignment double<<");
+    } else {
+        writeCodeHeader(">>angle_assignment<<");
     }
     
     int length;
@@ -474,14 +880,14 @@ void writeAngleAssignment(){
 
     if (nv + 1 <= 255) {
         computeAngleAssignmentCode(code, &length);
-        if (fwrite(code, sizeof (unsigned char), length, stdout) != length) {
+        if (fwrite(code, sizeof (unsigned char), length, f) != length) {
             fprintf(stderr, "fwrite() failed -- exiting!\n");
             exit(-1);
         }
     } else if (nv + 1 <= 65535){
         computeAngleAssignmentCodeShort(codeShort, &length);
-        putc(0, stdout);
-        if (fwrite(codeShort, sizeof (unsigned short), length, stdout) != length) {
+        putc(0, f);
+        if (fwrite(codeShort, sizeof (unsigned short), length, f) != length) {
             fprintf(stderr, "fwrite() failed -- exiting!\n");
             exit(-1);
         }
@@ -491,6 +897,36 @@ void writeAngleAssignment(){
     }
 }
 
+/*
+writes the angle values of the current solution after its angle assignment: for
+each angle the numerator and denominator as long long ints (rational), or the
+value as a double, in the byte order of this machine.
+*/
+void writeAngleValues(FILE *f){
+    int i;
+    
+    if(angleValueFormat == 'r'){
+        COEFFICIENT values[2*ANGLE_COUNT];
+        for(i = 0; i < ANGLE_COUNT; i++){
+            values[2*i] = angleValues[i].num;
+            values[2*i + 1] = angleValues[i].den;
+        }
+        if (fwrite(values, sizeof (COEFFICIENT), 2*ANGLE_COUNT, f) != 2*ANGLE_COUNT) {
+            fprintf(stderr, "fwrite() failed -- exiting!\n");
+            exit(-1);
+        }
+    } else if(angleValueFormat == 'd'){
+        double values[ANGLE_COUNT];
+        for(i = 0; i < ANGLE_COUNT; i++){
+            values[i] = (double) angleValues[i].num / angleValues[i].den;
+        }
+        if (fwrite(values, sizeof (double), ANGLE_COUNT, f) != ANGLE_COUNT) {
+            fprintf(stderr, "fwrite() failed -- exiting!\n");
+            exit(-1);
+        }
+    }
+}
+
 /*
 fills the array code with the planar code of the current quadrangulation.
 length will contain the length of the code. The maximum number of vertices is limited
@@ -545,13 +981,8 @@ void computePlanarCodeShort(unsigned short code[], int *length) {
     return;
 }
 
-void writePlanarCode(){
-    static boolean first = TRUE;
-    
-    if(first){
-        fprintf(stdout, ">>planar_code<<");
-        first = FALSE;
-    }
+void writePlanarCode(FILE *f){
+    writeCodeHeader(">>planar_code<<");
     
     int length;
     unsigned char code[MAXE + MAXN + 1];
@@ -560,14 +991,14 @@ void writePlanarCode(){
 
     if (nv + 1 <= 255) {
         computePlanarCode(code, &length);
-        if (fwrite(code, sizeof (unsigned char), length, stdout) != length) {
+        if (fwrite(code, sizeof (unsigned char), length, f) != length) {
             fprintf(stderr, "fwrite() failed -- exiting!\n");
             exit(-1);
         }
     } else if (nv + 1 <= 65535){
         computePlanarCodeShort(codeShort, &length);
-        putc(0, stdout);
-        if (fwrite(codeShort, sizeof (unsigned short), length, stdout) != length) {
+        putc(0, f);
+        if (fwrite(codeShort, sizeof (unsigned short), length, f) != length) {
             fprintf(stderr, "fwrite() failed -- exiting!\n");
             exit(-1);
         }
@@ -579,10 +1010,11 @@ void writePlanarCode(){
 
 void outputQuadrangulation(){
     if(outputFormat == 'c'){
-        writePlanarCode();
+        writePlanarCode(outputStream(CODE_OUTPUT));
     } else if (outputFormat == 'h'){
-        printPlanarGraph();
+        printPlanarGraph(outputStream(HUMAN_OUTPUT));
     }
+    limitOutputChunk();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -596,14 +1028,14 @@ struct list_el {
 
 typedef struct list_el item;
 
-item *perfect_matchings_counts = NULL;
+THREAD_LOCAL item *perfect_matchings_counts = NULL;
 
-item* increment(item* head, int key) {
+item* incrementBy(item* head, int key, int amount) {
     //first check whether the list is empty
     if (head == NULL) {
         item *new = (item *) malloc(sizeof (item));
         new->key = key;
-        new->value = 1;
+        new->value = amount;
         new->next = NULL;
         new->prev = NULL;
         return new;
@@ -616,12 +1048,12 @@ item* increment(item* head, int key) {
     }
 
     if (currentItem->key == key) {
-        currentItem->value++;
+        currentItem->value += amount;
         return head;
     } else if (currentItem->key < key) {
         item *new = (item *) malloc(sizeof (item));
         new->key = key;
-        new->value = 1;
+        new->value = amount;
         new->next = NULL;
         new->prev = currentItem;
         currentItem->next = new;
@@ -629,7 +1061,7 @@ item* increment(item* head, int key) {
     } else if (currentItem == head) {
         item *new = (item *) malloc(sizeof (item));
         new->key = key;
-        new->value = 1;
+        new->value = amount;
         new->next = head;
         new->prev = NULL;
         head->prev = new;
@@ -637,7 +1069,7 @@ item* increment(item* head, int key) {
     } else {
         item *new = (item *) malloc(sizeof (item));
         new->key = key;
-        new->value = 1;
+        new->value = amount;
         new->next = currentItem;
         new->prev = currentItem->prev;
         currentItem->prev->next = new;
@@ -646,13 +1078,26 @@ item* increment(item* head, int key) {
     }
 }
 
+item* increment(item* head, int key) {
+    return incrementBy(head, key, 1);
+}
+
+void freeList(item* head) {
+    while (head != NULL) {
+        item *next = head->next;
+        free(head);
+        head = next;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
-int cagqCertificate[MAXE+MAXN];
-int cagqAlternateCertificate[MAXE+MAXN];
-int cagqAlternateLabelling[MAXN];
-EDGE *alternateFirstedge[MAXN];
-int cagqQueue[MAXN];
+THREAD_LOCAL int cagqCertificate[MAXE+MAXN];
+THREAD_LOCAL int cagqAlternateCertificate[MAXE+MAXN];
+THREAD_LOCAL int cagqAlternateLabelling[MAXN];
+THREAD_LOCAL int cagqAlternateEdges[MAXE];
+THREAD_LOCAL EDGE *alternateFirstedge[MAXN];
+THREAD_LOCAL int cagqQueue[MAXN];
 
 void constructAlternateCertificate(EDGE *eStart){
     int i;
@@ -664,6 +1109,7 @@ void constructAlternateCertificate(EDGE *eStart){
     int tail = 0;
     int vertexCounter = 1;
     int cagqAlternateCertificatePosition = 0;
+    int cagqAlternateEdgesPosition = 0;
     cagqQueue[0] = eStart->start;
     alternateFirstedge[eStart->start] = eStart;
     cagqAlternateLabelling[eStart->start] = 0;
@@ -677,6 +1123,7 @@ void constructAlternateCertificate(EDGE *eStart){
                 alternateFirstedge[e->end] = e->inverse;
             }
             cagqAlternateCertificate[cagqAlternateCertificatePosition++] = cagqAlternateLabelling[e->end];
+            cagqAlternateEdges[cagqAlternateEdgesPosition++] = e - edges;
             e = e->next;
         } while (e!=elast);
         cagqAlternateCertificate[cagqAlternateCertificatePosition++] = MAXN;
@@ -693,6 +1140,7 @@ void constructAlternateCertificateOrientationReversing(EDGE *eStart){
     int tail = 0;
     int vertexCounter = 1;
     int cagqAlternateCertificatePosition = 0;
+    int cagqAlternateEdgesPosition = 0;
     cagqQueue[0] = eStart->start;
     alternateFirstedge[eStart->start] = eStart;
     cagqAlternateLabelling[eStart->start] = 0;
@@ -707,6 +1155,7 @@ void constructAlternateCertificateOrientationReversing(EDGE *eStart){
             }
             cagqAlternateCertificate[cagqAlternateCertificatePosition++] = cagqAlternateLabelling[e->end];
             e = e->prev;
+            cagqAlternateEdges[cagqAlternateEdgesPosition++] = e - edges;
         } while (e!=elast);
         cagqAlternateCertificate[cagqAlternateCertificatePosition++] = MAXN;
     }
@@ -719,12 +1168,15 @@ void calculateAutomorphismGroupQuadrangulation(){
     int pos = 0;
     int i, j;
     
+    int edgePos = 0;
+    
     for(i=0; i<nv; i++){
         EDGE *e, *elast;
 
         e = elast = firstedge[i];
         do {
             cagqCertificate[pos++] = e->end;
+            quadrangulationCertificateEdges[edgePos++] = e - edges;
             e = e->next;
         } while (e!=elast);
         cagqCertificate[pos++] = MAXN;
@@ -744,6 +1196,7 @@ void calculateAutomorphismGroupQuadrangulation(){
                     if(memcmp(cagqCertificate, cagqAlternateCertificate, sizeof(int)*pos) == 0) {
                         //store automorphism
                         memcpy(quadrangulationAutomorphisms[quadrangulationAutomorphismsCount], cagqAlternateLabelling, sizeof(int)*MAXN);
+                        memcpy(quadrangulationAutomorphismEdges[quadrangulationAutomorphismsCount], cagqAlternateEdges, sizeof(int)*ne);
                         quadrangulationAutomorphismsCount++;
                     }
                 }
@@ -752,6 +1205,7 @@ void calculateAutomorphismGroupQuadrangulation(){
                     if(memcmp(cagqCertificate, cagqAlternateCertificate, sizeof(int)*pos) == 0) {
                         //store automorphism
                         memcpy(quadrangulationAutomorphisms[quadrangulationAutomorphismsCount], cagqAlternateLabelling, sizeof(int)*MAXN);
+                        memcpy(quadrangulationAutomorphismEdges[quadrangulationAutomorphismsCount], cagqAlternateEdges, sizeof(int)*ne);
                         quadrangulationAutomorphismsCount++;
                     }
                 }
@@ -759,17 +1213,30 @@ void calculateAutomorphismGroupQuadrangulation(){
             } while (e!=elast);
         }
     }
+    
+    //store the faces containing the angles
+    for(j=0; j<ne; j++){
+        quadrangulationCertificateFaces[j] = edges[quadrangulationCertificateEdges[j]].rightface;
+        if(edges + quadrangulationCertificateEdges[j] == facestart[orderedFaces[0]]){
+            rootAnglePosition = j;
+        }
+    }
+    for(i=0; i<quadrangulationAutomorphismsCount; i++){
+        for(j=0; j<ne; j++){
+            quadrangulationAutomorphismFaces[i][j] = edges[quadrangulationAutomorphismEdges[i][j]].rightface;
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-int aaCertificate[MAXE+MAXN];
-int aaAnglesCertificate[MAXE+MAXN];
-int aaAlternateCertificate[MAXE+MAXN];
-int aaAnglesAlternateCertificate[MAXE+MAXN];
-int aaAlternateLabelling[MAXN];
-EDGE *aaAlternateFirstedge[MAXN];
-int aaQueue[MAXN];
+THREAD_LOCAL int aaCertificate[MAXE+MAXN];
+THREAD_LOCAL int aaAnglesCertificate[MAXE+MAXN];
+THREAD_LOCAL int aaAlternateCertificate[MAXE+MAXN];
+THREAD_LOCAL int aaAnglesAlternateCertificate[MAXE+MAXN];
+THREAD_LOCAL int aaAlternateLabelling[MAXN];
+THREAD_LOCAL EDGE *aaAlternateFirstedge[MAXN];
+THREAD_LOCAL int aaQueue[MAXN];
 
 void constructAlternateAngleAssignmentCertificate(EDGE *eStart){
     int i;
@@ -835,131 +1302,125 @@ void constructAlternateAngleAssignmentCertificateOrientationReversing(EDGE *eSta
 
 /**
  * Checks whether the current angle assignment is canonical.
+ * 
+ * The images of the angle assignment are the images under the automorphisms of
+ * the quadrangulation (see calculateAutomorphismGroupQuadrangulation()), both
+ * as is and with the angles relabelled by the symmetry of the quadrangle:
+ * alpha <-> delta and beta <-> gamma, or alpha <-> gamma for STCQ4. The
+ * relabelling is also applied to the angle assignment itself.
+ * 
+ * An image is first compared by the angle at rootAnglePosition: only images
+ * with the smaller angle of the pair {angle, relabelled angle} are considered.
+ * These are then compared by their angle certificates.
  */
 boolean isCanonicalAngleAssignment(){
-    //construct certificate
-    int pos = 0;
+    const char *relabelling = relabelledAngle[generateSTCQ4];
+    char angles[MAXE];
     int i, j;
     
-    for(i=0; i<nv; i++){
-        EDGE *e, *elast;
-
-        e = elast = firstedge[i];
-        do {
-            aaCertificate[pos] = e->end;
-            aaAnglesCertificate[pos++] = e->angle;
-            e = e->next;
-        } while (e!=elast);
-        aaCertificate[pos] = MAXN;
-        aaAnglesCertificate[pos++] = MAXN;
+    char rootAngle = edges[quadrangulationCertificateEdges[rootAnglePosition]].angle;
+    if(rootAngle > relabelling[(int)rootAngle]){
+        //the relabelled angle assignment is smaller
+        return FALSE;
     }
     
-    //construct alternate certificates
-    EDGE *ebase = firstedge[0];
+    //most quadrangulations are asymmetric
+    if(quadrangulationAutomorphismsCount == 0) return TRUE;
     
-    for(i=0; i<nv; i++){
-        if(degree[i]==degree[0]){
-            EDGE *e, *elast;
+    for(j = 0; j < ne; j++){
+        angles[j] = edges[quadrangulationCertificateEdges[j]].angle;
+    }
+    
+    for(i = 0; i < quadrangulationAutomorphismsCount; i++){
+        int *image = quadrangulationAutomorphismEdges[i];
+        char imageRootAngle = edges[image[rootAnglePosition]].angle;
+        //compare angle certificates
+        if(imageRootAngle <= relabelling[(int)imageRootAngle]){
+            for(j = 0; j < ne; j++){
+                char angle = edges[image[j]].angle;
+                if(angles[j] < angle){
+                    break;
+                } else if(angles[j] > angle){
+                    return FALSE;
+                }
+            }
+        }
+        //compare angle-reversed certificates
+        if(relabelling[(int)imageRootAngle] <= imageRootAngle){
+            for(j = 0; j < ne; j++){
+                char angle = relabelling[(int)edges[image[j]].angle];
+                if(angles[j] < angle){
+                    break;
+                } else if(angles[j] > angle){
+                    return FALSE;
+                }
+            }
+        }
+    }
+    return TRUE;
+}
 
-            e = elast = firstedge[i];
-            do {
-                if(e!=ebase){
-                    constructAlternateAngleAssignmentCertificate(e);
-                    //if the vertex certificates are equal, we compare the angle certificates
-                    if(memcmp(aaCertificate, aaAlternateCertificate, sizeof(int)*pos) == 0) {
-                        //compare angle certificates
-                        for(j = 0; j < pos; j++){
-                            if(aaAnglesCertificate[j] < aaAnglesAlternateCertificate[j]){
-                                break;
-                            } else if(aaAnglesCertificate[j] > aaAnglesAlternateCertificate[j]){
-                                return FALSE;
-                            }
-                        }
-                        //compare angle-reversed certificates
-                        if(generateSTCQ4){
-                            //when generating STCQ4 we can interchange alpha <-> gamma
-                            //compare angle-reversed certificates
-                            for(j = 0; j < pos; j++){
-                                if(aaAnglesAlternateCertificate[j]==0){ //alpha
-                                    if(aaAnglesCertificate[j] < 2){
-                                        break;
-                                    } else if(aaAnglesCertificate[j] > 2){
-                                        return FALSE;
-                                    }
-                                } else if(aaAnglesAlternateCertificate[j]==2){ //gamma
-                                    if(aaAnglesCertificate[j] > 0){
-                                        return FALSE;
-                                    }
-                                } else { //beta or delta
-                                    if(aaAnglesCertificate[j] < aaAnglesAlternateCertificate[j]){
-                                        break;
-                                    } else if(aaAnglesCertificate[j] > aaAnglesAlternateCertificate[j]){
-                                        return FALSE;
-                                    }
-                                }
-                            }
-                        } else {
-                            //when generating STCQ4 we can't interchange alpha <-> delta and beta <-> gamma
-                            //compare angle-reversed certificates
-                            for(j = 0; j < pos; j++){
-                                if(aaAnglesCertificate[j] < 3 - aaAnglesAlternateCertificate[j]){
-                                    break;
-                                } else if(aaAnglesCertificate[j] > 3 - aaAnglesAlternateCertificate[j]){
-                                    return FALSE;
-                                }
-                            }
-                        }
-                    }
+/**
+ * Checks whether the current partial angle assignment can still be completed
+ * to a canonical angle assignment. Only the angles in the faces for which
+ * faceDecided is set are known. If an image under an automorphism is smaller
+ * on a prefix of the certificate that is completely known, then the image of
+ * each completion will be smaller and thus the completion won't be canonical.
+ * 
+ * The angle at rootAnglePosition is always checked, so the direction of the
+ * first face is fixed even if the quadrangulation is asymmetric.
+ */
+boolean isPossiblyCanonicalAngleAssignment(){
+    const char *relabelling = relabelledAngle[generateSTCQ4];
+    int rootFace = quadrangulationCertificateFaces[rootAnglePosition];
+    int i, j;
+    
+    if(!breakSymmetry) return TRUE;
+    
+    if(faceDecided[rootFace]){
+        char rootAngle = edges[quadrangulationCertificateEdges[rootAnglePosition]].angle;
+        if(rootAngle > relabelling[(int)rootAngle]){
+            return FALSE;
+        }
+    }
+    
+    for(i = 0; i < quadrangulationAutomorphismsCount; i++){
+        int *image = quadrangulationAutomorphismEdges[i];
+        int *imageFaces = quadrangulationAutomorphismFaces[i];
+        if(!faceDecided[imageFaces[rootAnglePosition]]){
+            //the images can't be compared yet
+            continue;
+        }
+        char imageRootAngle = edges[image[rootAnglePosition]].angle;
+        //compare angle certificates
+        if(imageRootAngle <= relabelling[(int)imageRootAngle]){
+            for(j = 0; j < ne; j++){
+                if(!faceDecided[quadrangulationCertificateFaces[j]] || !faceDecided[imageFaces[j]]){
+                    break;
                 }
-                if(!mirrorImagesAreDistinct){
-                    constructAlternateAngleAssignmentCertificateOrientationReversing(e);
-                    //if the vertex certificates are equal, we compare the angle certificates
-                    if(memcmp(aaCertificate, aaAlternateCertificate, sizeof(int)*pos) == 0) {
-                        //compare angle certificates
-                        for(j = 0; j < pos; j++){
-                            if(aaAnglesCertificate[j] < aaAnglesAlternateCertificate[j]){
-                                break;
-                            } else if(aaAnglesCertificate[j] > aaAnglesAlternateCertificate[j]){
-                                return FALSE;
-                            }
-                        }
-                        if(generateSTCQ4){
-                            //when generating STCQ4 we can interchange alpha <-> gamma
-                            //compare angle-reversed certificates
-                            for(j = 0; j < pos; j++){
-                                if(aaAnglesAlternateCertificate[j]==0){ //alpha
-                                    if(aaAnglesCertificate[j] < 2){
-                                        break;
-                                    } else if(aaAnglesCertificate[j] > 2){
-                                        return FALSE;
-                                    }
-                                } else if(aaAnglesAlternateCertificate[j]==2){ //gamma
-                                    if(aaAnglesCertificate[j] > 0){
-                                        return FALSE;
-                                    }
-                                } else { //beta or delta
-                                    if(aaAnglesCertificate[j] < aaAnglesAlternateCertificate[j]){
-                                        break;
-                                    } else if(aaAnglesCertificate[j] > aaAnglesAlternateCertificate[j]){
-                                        return FALSE;
-                                    }
-                                }
-                            }
-                        } else {
-                            //when generating STCQ4 we can't interchange alpha <-> delta and beta <-> gamma
-                            //compare angle-reversed certificates
-                            for(j = 0; j < pos; j++){
-                                if(aaAnglesCertificate[j] < 3 - aaAnglesAlternateCertificate[j]){
-                                    break;
-                                } else if(aaAnglesCertificate[j] > 3 - aaAnglesAlternateCertificate[j]){
-                                    return FALSE;
-                                }
-                            }
-                        }
-                    }
+                char angle = edges[quadrangulationCertificateEdges[j]].angle;
+                char imageAngle = edges[image[j]].angle;
+                if(angle < imageAngle){
+                    break;
+                } else if(angle > imageAngle){
+                    return FALSE;
                 }
-                e = e->next;
-            } while (e!=elast);
+            }
+        }
+        //compare angle-reversed certificates
+        if(relabelling[(int)imageRootAngle] <= imageRootAngle){
+            for(j = 0; j < ne; j++){
+                if(!faceDecided[quadrangulationCertificateFaces[j]] || !faceDecided[imageFaces[j]]){
+                    break;
+                }
+                char angle = edges[quadrangulationCertificateEdges[j]].angle;
+                char imageAngle = relabelling[(int)edges[image[j]].angle];
+                if(angle < imageAngle){
+                    break;
+                } else if(angle > imageAngle){
+                    return FALSE;
+                }
+            }
         }
     }
     return TRUE;
@@ -1024,519 +1485,1152 @@ void calculateAutomorphismGroupAngleAssignments(){
 
 //////////////////////////////////////////////////////////////////////////////
 
-void handleSolution(lprec *lp) {
+void handleSolution() {
     if(!isCanonicalAngleAssignment()) return;
     solvableAndCanonical++;
     if(outputSolution){
         if(outputFormat == 'h'){
             //human-readable output
-            printSphericalTilingByCongruentQuadrangles(lp);
+            printSphericalTilingByCongruentQuadrangles(outputStream(HUMAN_OUTPUT));
         } else if(outputFormat == 'c'){
             //code
-
+            writeAngleAssignment(outputStream(CODE_OUTPUT));
+            writeAngleValues(outputStream(CODE_OUTPUT));
         }
-        if(latexPerSolution || latexSummaryFile!=NULL){
+        if(latexPerSolution && outputStream(LATEX_OUTPUT) != NULL){
+            //the solution is written to a separate file in the order of the input
+            printAngleAssignmentLatex(outputStream(LATEX_OUTPUT));
+            fputc('\0', outputStream(LATEX_OUTPUT));
+        } else if(latexPerSolution){
+            //output to a separate LaTeX file
+            pthread_mutex_lock(&outputLock);
+            FILE *f = openLatexSolutionFile();
+            if(f != NULL){
+                printAngleAssignmentLatex(f);
+                fclose(f);
+            }
+            pthread_mutex_unlock(&outputLock);
+        } else if(latexSummaryFile!=NULL){
             //output to LaTeX
-            printAngleAssignmentLatex();
+            printAngleAssignmentLatex(outputStream(LATEX_OUTPUT));
         }
+        limitOutputChunk();
     }
 }
 
 void printSystem() {
     int i;
+    FILE *f = outputStream(HUMAN_OUTPUT);
     for (i = 0; i < nv; i++) {
         if (printDuplicateEquations || !isDuplicateEquation[i]) {
-            fprintf(stderr, "(%d,%d,%d,%d)\n", alphaCount[i], betaCount[i], gammaCount[i], deltaCount[i]);
+            fprintf(f, "(%d,%d,%d,%d)\n", alphaCount(i), betaCount(i), gammaCount(i), deltaCount(i));
         }
     }
-    fprintf(stderr, "\n");
+    fprintf(f, "\n");
 }
 
 void simplifySystem() {
     //nothing to do at the moment
 }
 
-void solveSystem() {
-    lprec *lp;
-    int *colno = NULL, i, j;
-    REAL *row = NULL;
+//////////////////////////////////////////////////////////////////////////////
 
-    lp = make_lp(0, 4);
-    /* There are 4 angles.
-     */
-    if (lp == NULL) {
-        exit(1);
-    }
-    if(onlyConvex){
-        if(generateSTCQ4){
-            resize_lp(lp, nv + 3 - duplicateEquationCount, get_Ncolumns(lp));
-        } else {
-            resize_lp(lp, nv + 5 - duplicateEquationCount, get_Ncolumns(lp));
-        }
-        /* There nv + 1 equations: one for each vertex plus the extra equation
-         * 
-         *     alpha + beta + gamma + delta = 2 +4/F.
-         * 
-         * Of course we only add each distinct equation once, so we subtract the
-         * number of duplicate equations.
-         * For STCQ2 there are also 4 inequalities:
-         *     alpha - beta + delta < 1
-         *     alpha + beta - delta < 1
-         *     alpha - gamma + delta < 1
-         *    -alpha + gamma + delta < 1
-         * For STCQ4 there are 2 inequalities:
-         *     alpha - gamma + delta < 1
-         *    -alpha + gamma + delta < 1
-         */
-    } else {
-        resize_lp(lp, nv + 1 - duplicateEquationCount, get_Ncolumns(lp));
-        /* There nv + 1 equations: one for each vertex plus the extra equation
-         * 
-         *     alpha + beta + gamma + delta = 2 +4/F.
-         * 
-         * Of course we only add each distinct equation once, so we subtract the
-         * number of duplicate equations.
-         */
-    }
+/* Exact feasibility test for the system of the current angle assignment.
+ * 
+ * The unknowns are the angles alpha, beta, gamma and delta (in units of pi).
+ * Each distinct vertex gives an equation with integer coefficients and right
+ * hand side 2, and the area of a face gives the equation
+ * 
+ *     alpha + beta + gamma + delta = 2 + 4/F,
+ * 
+ * which is multiplied by F to have integer coefficients. All other restrictions
+ * are strict inequalities: 0 < x < 2 for each angle (0 < x < 1 for convex
+ * tilings) and, for convex tilings, the inequalities that express that the
+ * diagonals are shorter than pi.
+ * 
+ * The equations are eliminated fraction-free, after which the inequalities
+ * only contain the free angles. Since there are at most 3 free angles, the
+ * inequalities are decided exactly by Fourier-Motzkin elimination and a
+ * rational solution is obtained by back substitution.
+ */
 
-    //name the columns
-    set_col_name(lp, 1, "alpha");
-    set_col_name(lp, 2, "beta");
-    set_col_name(lp, 3, "gamma");
-    set_col_name(lp, 4, "delta");
+#define MAXINEQUALITIES 1024
 
-    REAL epsilon = 0.000001;
-    REAL lowerBoundAngle = 0 + epsilon;
-    REAL upperBoundAngle = 2 - epsilon;
-    if(onlyConvex){
-        upperBoundAngle = 1 - epsilon;
+/* The strict inequality c[0]*alpha + c[1]*beta + c[2]*gamma + c[3]*delta < rhs
+ */
+typedef struct {
+    COEFFICIENT c[ANGLE_COUNT];
+    COEFFICIENT rhs;
+} INEQUALITY;
+
+THREAD_LOCAL COEFFICIENT angleEquations[MAXN + 1][ANGLE_COUNT + 1];
+THREAD_LOCAL int angleEquationsPivot[ANGLE_COUNT];
+
+THREAD_LOCAL INEQUALITY fmSystem[ANGLE_COUNT][MAXINEQUALITIES];
+THREAD_LOCAL int fmSystemSize[ANGLE_COUNT];
+
+COEFFICIENT gcd(COEFFICIENT a, COEFFICIENT b){
+    if(a < 0) a = -a;
+    if(b < 0) b = -b;
+    while(b){
+        COEFFICIENT t = a % b;
+        a = b;
+        b = t;
     }
-    set_bounds(lp, 1, lowerBoundAngle, upperBoundAngle);
-    set_bounds(lp, 2, lowerBoundAngle, upperBoundAngle);
-    set_bounds(lp, 3, lowerBoundAngle, upperBoundAngle);
-    set_bounds(lp, 4, lowerBoundAngle, upperBoundAngle);
+    return a;
+}
 
-    colno = (int *) malloc(4 * sizeof (*colno));
-    row = (REAL *) malloc(4 * sizeof (*row));
-    if ((colno == NULL) || (row == NULL)) {
-        exit(1);
+RATIONAL makeRational(COEFFICIENT num, COEFFICIENT den){
+    RATIONAL r;
+    COEFFICIENT g = gcd(num, den);
+    if(den < 0){
+        g = -g;
     }
+    r.num = num / g;
+    r.den = den / g;
+    return r;
+}
 
-    colno[0] = 1;
-    row[0] = 1;
+RATIONAL addRationals(RATIONAL a, RATIONAL b){
+    return makeRational(a.num * b.den + b.num * a.den, a.den * b.den);
+}
 
-    if (!set_obj_fnex(lp, 1, row, colno)) {
-        exit(1);
+RATIONAL scaleRational(RATIONAL a, COEFFICIENT num, COEFFICIENT den){
+    return makeRational(a.num * num, a.den * den);
+}
+
+int compareRationals(RATIONAL a, RATIONAL b){
+    COEFFICIENT lhs = a.num * b.den;
+    COEFFICIENT rhs = b.num * a.den;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+void normalizeEquation(COEFFICIENT *equation){
+    int i;
+    COEFFICIENT g = 0;
+    for(i = 0; i <= ANGLE_COUNT; i++){
+        g = gcd(g, equation[i]);
     }
+    if(g > 1){
+        for(i = 0; i <= ANGLE_COUNT; i++){
+            equation[i] /= g;
+        }
+    }
+}
 
-    set_add_rowmode(lp, TRUE); //start adding rows
+/* Divides the inequality by the gcd of its coefficients. Returns FALSE if the
+ * inequality is of the form 0 < rhs with rhs <= 0, and TRUE otherwise.
+ */
+boolean normalizeInequality(INEQUALITY *inequality){
+    int i;
+    COEFFICIENT g = 0;
+    for(i = 0; i < ANGLE_COUNT; i++){
+        g = gcd(g, inequality->c[i]);
+    }
+    if(g == 0){
+        return inequality->rhs > 0;
+    }
+    g = gcd(g, inequality->rhs);
+    if(g > 1){
+        for(i = 0; i < ANGLE_COUNT; i++){
+            inequality->c[i] /= g;
+        }
+        inequality->rhs /= g;
+    }
+    return TRUE;
+}
 
-    for (i = 0; i < nv; i++) {
-        if (!isDuplicateEquation[i]) {
-            j = 0;
+boolean isConstantInequality(INEQUALITY *inequality){
+    return !inequality->c[0] && !inequality->c[1] &&
+           !inequality->c[2] && !inequality->c[3];
+}
 
-            if (alphaCount[i] != 0) {
-                colno[j] = 1;
-                row[j++] = alphaCount[i];
+/* Substitutes the pivot angles in the inequality and adds it to the first
+ * stage of the Fourier-Motzkin elimination. Returns FALSE if the inequality
+ * cannot be satisfied.
+ */
+boolean addAngleInequality(int rank, COEFFICIENT a, COEFFICIENT b, COEFFICIENT c, COEFFICIENT d, COEFFICIENT rhs){
+    int i, k;
+    INEQUALITY inequality;
+    inequality.c[0] = a;
+    inequality.c[1] = b;
+    inequality.c[2] = c;
+    inequality.c[3] = d;
+    inequality.rhs = rhs;
+    
+    for(k = 0; k < rank; k++){
+        int column = angleEquationsPivot[k];
+        COEFFICIENT factor = inequality.c[column];
+        if(factor){
+            //pivot is positive, so the direction of the inequality is kept
+            COEFFICIENT pivot = angleEquations[k][column];
+            for(i = 0; i < ANGLE_COUNT; i++){
+                inequality.c[i] = pivot*inequality.c[i] - factor*angleEquations[k][i];
             }
+            inequality.rhs = pivot*inequality.rhs - factor*angleEquations[k][ANGLE_COUNT];
+        }
+    }
+    
+    if(!normalizeInequality(&inequality)){
+        return FALSE;
+    }
+    if(!isConstantInequality(&inequality)){
+        fmSystem[0][fmSystemSize[0]++] = inequality;
+    }
+    return TRUE;
+}
 
-            if (betaCount[i] != 0) {
-                colno[j] = 2;
-                row[j++] = betaCount[i];
+/* Eliminates the given angle from the inequalities in stage and stores the
+ * result in stage + 1. Returns FALSE if the system is found to be infeasible.
+ */
+boolean fourierMotzkinStep(int stage, int angle){
+    int i, j, k;
+    INEQUALITY *current = fmSystem[stage];
+    int currentSize = fmSystemSize[stage];
+    INEQUALITY *next = fmSystem[stage + 1];
+    int nextSize = 0;
+    
+    for(i = 0; i < currentSize; i++){
+        if(current[i].c[angle] == 0){
+            next[nextSize++] = current[i];
+        } else if(current[i].c[angle] > 0){
+            for(j = 0; j < currentSize; j++){
+                if(current[j].c[angle] < 0){
+                    if(nextSize + currentSize >= MAXINEQUALITIES){
+                        fprintf(stderr, "MAXINEQUALITIES too small: %d\n", MAXINEQUALITIES);
+                        exit(1);
+                    }
+                    COEFFICIENT positiveFactor = -current[j].c[angle];
+                    COEFFICIENT negativeFactor = current[i].c[angle];
+                    for(k = 0; k < ANGLE_COUNT; k++){
+                        next[nextSize].c[k] = positiveFactor*current[i].c[k] + negativeFactor*current[j].c[k];
+                    }
+                    next[nextSize].rhs = positiveFactor*current[i].rhs + negativeFactor*current[j].rhs;
+                    if(!normalizeInequality(next + nextSize)){
+                        return FALSE;
+                    }
+                    if(!isConstantInequality(next + nextSize)){
+                        nextSize++;
+                    }
+                }
             }
+        }
+    }
+    
+    fmSystemSize[stage + 1] = nextSize;
+    return TRUE;
+}
 
-            if (gammaCount[i] != 0) {
-                colno[j] = 3;
-                row[j++] = gammaCount[i];
+/* Chooses a value for the given angle that satisfies all inequalities of the
+ * given stage, assuming that the values of the other angles that have not yet
+ * been eliminated in that stage are already stored in angleValues. Returns FALSE
+ * if no such value exists.
+ */
+boolean chooseAngleValue(int stage, int angle){
+    int i, k;
+    boolean hasLowerBound = FALSE, hasUpperBound = FALSE;
+    RATIONAL lowerBound, upperBound;
+    
+    for(i = 0; i < fmSystemSize[stage]; i++){
+        INEQUALITY *inequality = fmSystem[stage] + i;
+        RATIONAL remainder = makeRational(inequality->rhs, 1);
+        for(k = 0; k < ANGLE_COUNT; k++){
+            if(k != angle && inequality->c[k]){
+                remainder = addRationals(remainder, scaleRational(angleValues[k], -inequality->c[k], 1));
             }
-
-            if (deltaCount[i] != 0) {
-                colno[j] = 4;
-                row[j++] = deltaCount[i];
+        }
+        if(inequality->c[angle] > 0){
+            RATIONAL bound = scaleRational(remainder, 1, inequality->c[angle]);
+            if(!hasUpperBound || compareRationals(bound, upperBound) < 0){
+                upperBound = bound;
+                hasUpperBound = TRUE;
             }
-
-            if (!add_constraintex(lp, j, row, colno, EQ, 2)) {
-                exit(1);
+        } else if(inequality->c[angle] < 0){
+            RATIONAL bound = scaleRational(remainder, 1, inequality->c[angle]);
+            if(!hasLowerBound || compareRationals(bound, lowerBound) > 0){
+                lowerBound = bound;
+                hasLowerBound = TRUE;
             }
         }
     }
+    
+    if(hasLowerBound && hasUpperBound){
+        if(compareRationals(lowerBound, upperBound) >= 0){
+            return FALSE;
+        }
+        angleValues[angle] = scaleRational(addRationals(lowerBound, upperBound), 1, 2);
+    } else if(hasLowerBound){
+        angleValues[angle] = addRationals(lowerBound, makeRational(1, 1));
+    } else if(hasUpperBound){
+        angleValues[angle] = addRationals(upperBound, makeRational(-1, 1));
+    } else {
+        angleValues[angle] = makeRational(0, 1);
+    }
+    return TRUE;
+}
 
-    colno[0] = 1;
-    row[0] = 1;
-    colno[1] = 2;
-    row[1] = 1;
-    colno[2] = 3;
-    row[2] = 1;
-    colno[3] = 4;
-    row[3] = 1;
-
-    if (!add_constraintex(lp, 4, row, colno, EQ, 2 + 4.0 / (nv - 2))) {
-        exit(1);
+/* Returns TRUE if the system for the current angle assignment has a solution,
+ * and FALSE otherwise. If there is a solution, then one is stored in angleValues.
+ */
+boolean isFeasibleAngleSystem(){
+    int i, j, k;
+    int equationCount = 0;
+    int rank = 0;
+    int freeAngles[ANGLE_COUNT];
+    int freeAngleCount = 0;
+    for (i = 0; i < nv; i++) {
+        if (!isDuplicateEquation[i]) {
+            angleEquations[equationCount][0] = alphaCount(i);
+            angleEquations[equationCount][1] = betaCount(i);
+            angleEquations[equationCount][2] = gammaCount(i);
+            angleEquations[equationCount][3] = deltaCount(i);
+            angleEquations[equationCount][4] = 2;
+            equationCount++;
+        }
+    }
+    //F*(alpha + beta + gamma + delta) = 2F + 4
+    for (k = 0; k < ANGLE_COUNT; k++) {
+        angleEquations[equationCount][k] = nf;
     }
+    angleEquations[equationCount][ANGLE_COUNT] = 2*nf + 4;
+    equationCount++;
     
-    if(onlyConvex){
-
-        if(!generateSTCQ4){
-            //the following constraints are only applicable for STCQ2
-            colno[0] = 1;
-            row[0] = 1;
-            colno[1] = 2;
-            row[1] = -1;
-            colno[2] = 3;
-            row[2] = 0;
-            colno[3] = 4;
-            row[3] = 1;
-
-            //in case of onlyConvex: upperBoundAngle = 1 - epsilon
-            if (!add_constraintex(lp, 4, row, colno, LE, upperBoundAngle)) {
-                exit(1);
+    //fraction-free Gauss-Jordan elimination
+    for (j = 0; j < ANGLE_COUNT; j++) {
+        int pivotRow = rank;
+        while (pivotRow < equationCount && angleEquations[pivotRow][j] == 0) pivotRow++;
+        if (pivotRow == equationCount) {
+            freeAngles[freeAngleCount++] = j;
+            continue;
+        }
+        for (k = 0; k <= ANGLE_COUNT; k++) {
+            COEFFICIENT t = angleEquations[rank][k];
+            angleEquations[rank][k] = angleEquations[pivotRow][k];
+            angleEquations[pivotRow][k] = t;
+        }
+        if (angleEquations[rank][j] < 0) {
+            for (k = 0; k <= ANGLE_COUNT; k++) {
+                angleEquations[rank][k] = -angleEquations[rank][k];
             }
-
-
-            colno[0] = 1;
-            row[0] = 1;
-            colno[1] = 2;
-            row[1] = 1;
-            colno[2] = 3;
-            row[2] = 0;
-            colno[3] = 4;
-            row[3] = -1;
-
-            //in case of onlyConvex: upperBoundAngle = 1 - epsilon
-            if (!add_constraintex(lp, 4, row, colno, LE, upperBoundAngle)) {
-                exit(1);
+        }
+        COEFFICIENT pivot = angleEquations[rank][j];
+        for (i = 0; i < equationCount; i++) {
+            COEFFICIENT factor = angleEquations[i][j];
+            if (i != rank && factor) {
+                for (k = 0; k <= ANGLE_COUNT; k++) {
+                    angleEquations[i][k] = pivot*angleEquations[i][k] - factor*angleEquations[rank][k];
+                }
+                normalizeEquation(angleEquations[i]);
             }
         }
-
-        colno[0] = 1;
-        row[0] = 1;
-        colno[1] = 2;
-        row[1] = 0;
-        colno[2] = 3;
-        row[2] = -1;
-        colno[3] = 4;
-        row[3] = 1;
-        
-        //in case of onlyConvex: upperBoundAngle = 1 - epsilon
-        if (!add_constraintex(lp, 4, row, colno, LE, upperBoundAngle)) {
-            exit(1);
+        angleEquationsPivot[rank++] = j;
+    }
+    
+    //the remaining equations are of the form 0 = rhs
+    for (i = rank; i < equationCount; i++) {
+        if (angleEquations[i][ANGLE_COUNT]) {
+            return FALSE;
         }
-
-        colno[0] = 1;
-        row[0] = -1;
-        colno[1] = 2;
-        row[1] = 0;
-        colno[2] = 3;
-        row[2] = 1;
-        colno[3] = 4;
-        row[3] = 1;
-        
-        //in case of onlyConvex: upperBoundAngle = 1 - epsilon
-        if (!add_constraintex(lp, 4, row, colno, LE, upperBoundAngle)) {
-            exit(1);
+    }
+    
+    //bounds on the angles
+    COEFFICIENT upperBoundAngle = onlyConvex ? 1 : 2;
+    fmSystemSize[0] = 0;
+    for (k = 0; k < ANGLE_COUNT; k++) {
+        COEFFICIENT c[ANGLE_COUNT] = {0, 0, 0, 0};
+        c[k] = -1;
+        if (!addAngleInequality(rank, c[0], c[1], c[2], c[3], 0)) {
+            return FALSE;
+        }
+        c[k] = 1;
+        if (!addAngleInequality(rank, c[0], c[1], c[2], c[3], upperBoundAngle)) {
+            return FALSE;
+        }
+    }
+    
+    if (onlyConvex) {
+        /* For STCQ2 there are 4 inequalities:
+         *     alpha - beta + delta < 1
+         *     alpha + beta - delta < 1
+         *     alpha - gamma + delta < 1
+         *    -alpha + gamma + delta < 1
+         * For STCQ4 there are 2 inequalities:
+         *     alpha - gamma + delta < 1
+         *    -alpha + gamma + delta < 1
+         */
+        if (!generateSTCQ4) {
+            if (!addAngleInequality(rank, 1, -1, 0, 1, 1) ||
+                    !addAngleInequality(rank, 1, 1, 0, -1, 1)) {
+                return FALSE;
+            }
+        }
+        if (!addAngleInequality(rank, 1, 0, -1, 1, 1) ||
+                !addAngleInequality(rank, -1, 0, 1, 1, 1)) {
+            return FALSE;
+        }
+    }
+    
+    //eliminate all free angles but the last one
+    for (i = 0; i < freeAngleCount - 1; i++) {
+        if (!fourierMotzkinStep(i, freeAngles[i])) {
+            return FALSE;
+        }
+    }
+    
+    //back substitution
+    for (i = freeAngleCount - 1; i >= 0; i--) {
+        if (!chooseAngleValue(i, freeAngles[i])) {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < rank; i++) {
+        int angle = angleEquationsPivot[i];
+        RATIONAL value = makeRational(angleEquations[i][ANGLE_COUNT], 1);
+        for (k = 0; k < ANGLE_COUNT; k++) {
+            if (k != angle && angleEquations[i][k]) {
+                value = addRationals(value, scaleRational(angleValues[k], -angleEquations[i][k], 1));
+            }
         }
+        angleValues[angle] = scaleRational(value, 1, angleEquations[i][angle]);
     }
+    
+    return TRUE;
+}
 
-    set_add_rowmode(lp, FALSE); //stop adding rows
+void handleSystemVerdict(boolean isFeasible) {
+    if (isFeasible) {
+        solvable++;
+        handleSolution();
+    } else if (printUnsolvableSystems || writeUnsolvedSystems) {
+        pthread_mutex_lock(&outputLock);
+        printSystem();
+        pthread_mutex_unlock(&outputLock);
+    }
+}
 
-    set_maxim(lp);
+boolean solveSystem() {
+    boolean isFeasible = isFeasibleAngleSystem();
+    handleSystemVerdict(isFeasible);
+    return isFeasible;
+}
 
-#ifdef _DEBUG
-    write_LP(lp, stderr);
-#endif
+//////////////////////////////////////////////////////////////////////////////
 
-    set_verbose(lp, SEVERE);
+/* Cache of the verdicts of the systems that were already solved during this run.
+ * 
+ * The feasibility of a system only depends on the set of distinct equations,
+ * and not on the vertices at which they occur. Each equation is packed in a
+ * single word with one byte per angle, and the key of a system consists of the
+ * sorted packed equations, the number of faces and the mode (convex or not,
+ * STCQ2 or STCQ4).
+ */
 
-    int result = solve(lp);
+#define FEASIBILITY_CACHE_SIZE (1<<16) //the number of buckets; must be a power of 2
+#define MAX_FEASIBILITY_CACHE_ENTRIES (1<<22)
+
+struct feasibility_cache_el {
+    int faceCount;
+    int mode;
+    int equationCount;
+    boolean isFeasible;
+    boolean isPersistent; //TRUE if the entry was loaded from the cache file
+    RATIONAL angleValues[ANGLE_COUNT];
+    struct feasibility_cache_el *next;
+    PACKED_EQUATION equations[];
+};
 
-    if (result == OPTIMAL) {
-        solvable++;
-        handleSolution(lp);
-    } else if (printUnsolvableSystems || writeLpsolveUnsolvedSystems) {
-        printSystem();
-    }
+typedef struct feasibility_cache_el FEASIBILITY_CACHE_ENTRY;
 
-#ifdef _DEBUG
-    fprintf(stderr, "Objective value: %f\n", get_objective(lp));
+THREAD_LOCAL FEASIBILITY_CACHE_ENTRY *feasibilityCache[FEASIBILITY_CACHE_SIZE];
+THREAD_LOCAL unsigned long long int feasibilityCacheEntries = 0;
 
-    get_variables(lp, row);
-    for (j = 0; j < 4; j++) {
-        fprintf(stderr, "%s: %f\n", get_col_name(lp, j + 1), row[j]);
-    }
+boolean useFeasibilityCache = TRUE;
 
-    fprintf(stderr, "\n");
-#endif
+THREAD_LOCAL unsigned long long int feasibilityCacheHits = 0;
+THREAD_LOCAL unsigned long long int feasibilityCacheMisses = 0;
 
-    free(row);
-    free(colno);
+THREAD_LOCAL PACKED_EQUATION systemKey[MAXN];
+THREAD_LOCAL int systemKeyLength;
+THREAD_LOCAL unsigned int systemKeyHash;
 
-    delete_lp(lp);
+int getSystemMode(){
+    return (onlyConvex ? 1 : 0) | (generateSTCQ4 ? 2 : 0);
 }
 
-unsigned long long int assignmentCount = 0;
-
-void createSystem() {
-    //clear systems
+unsigned int hashSystemKey(PACKED_EQUATION *equations, int equationCount, int faceCount, int mode){
     int i;
-    for (i = 0; i < nv; i++) {
-        alphaCount[i] = betaCount[i] = gammaCount[i] = deltaCount[i] = 0;
+    //FNV-1a
+    unsigned int hash = 2166136261u;
+    hash = (hash ^ (unsigned int) faceCount) * 16777619u;
+    hash = (hash ^ (unsigned int) mode) * 16777619u;
+    for (i = 0; i < equationCount; i++) {
+        hash = (hash ^ equations[i]) * 16777619u;
     }
+    return hash;
+}
 
-    //iterate over all faces
-    for (i = 0; i < nv - 2; i++) {
-        EDGE *e1 = matchingEdges[orderedFaces[i]];
-        EDGE *e2 = e1->inverse->prev;
-        EDGE *e3 = e2->inverse->prev;
-        EDGE *e4 = e3->inverse->prev;
-
-        //assert: e1 = e4->inverse->prev;
-        if (angleAssigmentDirection[i]) {
-            alphaCount[e1->end] += 1;
-            betaCount[e2->end] += 1;
-            gammaCount[e3->end] += 1;
-            deltaCount[e4->end] += 1;
-            e2->angle = 0;
-            e3->angle = 1;
-            e4->angle = 2;
-            e1->angle = 3;
-        } else {
-            alphaCount[e4->end] += 1;
-            betaCount[e3->end] += 1;
-            gammaCount[e2->end] += 1;
-            deltaCount[e1->end] += 1;
-            e1->angle = 0;
-            e4->angle = 1;
-            e3->angle = 2;
-            e2->angle = 3;
+/* Stores the sorted distinct equations of the current system in systemKey
+ * and computes the hash value of the key.
+ */
+void computeSystemKey(){
+    int i, j;
+    
+    systemKeyLength = 0;
+    for (i = 0; i < nv; i++) {
+        if (!isDuplicateEquation[i]) {
+            PACKED_EQUATION equation = vertexEquation[i];
+            //insertion sort: there are only a few distinct equations
+            for (j = systemKeyLength; j > 0 && systemKey[j-1] > equation; j--) {
+                systemKey[j] = systemKey[j-1];
+            }
+            systemKey[j] = equation;
+            systemKeyLength++;
         }
     }
+    
+    systemKeyHash = hashSystemKey(systemKey, systemKeyLength, nf, getSystemMode());
 }
-void createPartialSystem(int currentFaceCount) {
-    //clear systems
-    int i;
-    for (i = 0; i < nv; i++) {
-        alphaCount[i] = betaCount[i] = gammaCount[i] = deltaCount[i] = 0;
-    }
-
-    //iterate over all faces
-    for (i = 0; i < currentFaceCount; i++) {
-        EDGE *e1 = matchingEdges[orderedFaces[i]];
-        EDGE *e2 = e1->inverse->prev;
-        EDGE *e3 = e2->inverse->prev;
-        EDGE *e4 = e3->inverse->prev;
-
-        //assert: e1 = e4->inverse->prev;
-        if (angleAssigmentDirection[i]) {
-            alphaCount[e1->end] += 1;
-            betaCount[e2->end] += 1;
-            gammaCount[e3->end] += 1;
-            deltaCount[e4->end] += 1;
-            e2->angle = 0;
-            e3->angle = 1;
-            e4->angle = 2;
-            e1->angle = 3;
-        } else {
-            alphaCount[e4->end] += 1;
-            betaCount[e3->end] += 1;
-            gammaCount[e2->end] += 1;
-            deltaCount[e1->end] += 1;
-            e1->angle = 0;
-            e4->angle = 1;
-            e3->angle = 2;
-            e2->angle = 3;
+
+FEASIBILITY_CACHE_ENTRY *findCachedSystemEntry(PACKED_EQUATION *equations, int equationCount,
+        int faceCount, int mode, unsigned int hash){
+    FEASIBILITY_CACHE_ENTRY *entry = feasibilityCache[hash & (FEASIBILITY_CACHE_SIZE - 1)];
+    while (entry != NULL) {
+        if (entry->faceCount == faceCount && entry->mode == mode &&
+                entry->equationCount == equationCount &&
+                memcmp(entry->equations, equations, sizeof(PACKED_EQUATION)*equationCount) == 0) {
+            return entry;
         }
+        entry = entry->next;
     }
+    return NULL;
 }
 
-boolean firstCheckOfSystem() {
-    int i, j;
-    /* If the system contains two equations that are at hamming distance 1,
-     * we return FALSE. At the same time we remove duplicate equations (i.e.
-     * equations that are at Hamming distance 0).
-     */
-
-    //reset array
-    for (i = 0; i < nv; i++) {
-        isDuplicateEquation[i] = FALSE;
+FEASIBILITY_CACHE_ENTRY *insertCachedSystemEntry(PACKED_EQUATION *equations, int equationCount, int faceCount,
+        int mode, unsigned int hash, boolean isFeasible, RATIONAL *values){
+    if (feasibilityCacheEntries == MAX_FEASIBILITY_CACHE_ENTRIES) {
+        //the cache is full: we just stop adding entries
+        return NULL;
     }
-    duplicateEquationCount = 0;
-
-    for (i = 0; i < nv - 1; i++) {
-        if (isDuplicateEquation[i]) continue;
-        /*
-         * this equation is already a duplicate itself, so any equation
-         * that would be at Hamming distance 1 of this equation is also
-         * at Hamming distance 1 of that earlier equation.
-         */
-        for (j = i + 1; j < nv; j++) {
-            if (isDuplicateEquation[j]) continue;
-            /*
-             * this equation is already a duplicate, so any equation
-             * that would be at Hamming distance 1 of this equation is also
-             * at Hamming distance 1 of that earlier equation.
-             */
-            int diffAlpha = alphaCount[i] - alphaCount[j];
-            int diffBeta = betaCount[i] - betaCount[j];
-            int diffGamma = gammaCount[i] - gammaCount[j];
-            int diffDelta = deltaCount[i] - deltaCount[j];
-            
-            int hammingDistance = 0;
-            if (diffAlpha != 0) hammingDistance++;
-            if (diffBeta != 0) hammingDistance++;
-            if (diffGamma != 0) hammingDistance++;
-            if (diffDelta != 0) hammingDistance++;
-            if (hammingDistance == 0) {
-                // if we get here, then equation j is a duplicate of i
-                isDuplicateEquation[j] = TRUE;
-                duplicateEquationCount++;
-            } else {
-                if((diffAlpha<=0 && diffBeta<=0 && diffGamma<=0 && diffDelta<=0) || (diffAlpha>=0 && diffBeta>=0 && diffGamma>=0 && diffDelta>=0)){
-                    return FALSE;
-                }
-                if(diffAlpha==-diffGamma && diffBeta==0 && diffDelta==0){
-                    //alpha==gamma
-                    return FALSE;
-                }
-                if(diffAlpha==-diffDelta && diffGamma==0 && diffBeta==0){
-                    //alpha==delta
-                    return FALSE;
-                }
-                if(diffBeta==-diffGamma && diffAlpha==0 && diffDelta==0){
-                    //beta==gamma
-                    return FALSE;
-                }
-                if(diffBeta==-diffDelta && diffGamma==0 && diffAlpha==0){
-                    //beta==delta
-                    return FALSE;
-                }
-            }
-        }
+    FEASIBILITY_CACHE_ENTRY *entry = (FEASIBILITY_CACHE_ENTRY *)
+            malloc(sizeof (FEASIBILITY_CACHE_ENTRY) + sizeof (PACKED_EQUATION)*equationCount);
+    if (entry == NULL) {
+        fprintf(stderr, "Insufficient memory for feasibility cache -- exiting!\n");
+        exit(1);
     }
-    return TRUE;
+    entry->faceCount = faceCount;
+    entry->mode = mode;
+    entry->equationCount = equationCount;
+    entry->isFeasible = isFeasible;
+    entry->isPersistent = FALSE;
+    memcpy(entry->angleValues, values, sizeof (RATIONAL)*ANGLE_COUNT);
+    memcpy(entry->equations, equations, sizeof (PACKED_EQUATION)*equationCount);
+    entry->next = feasibilityCache[hash & (FEASIBILITY_CACHE_SIZE - 1)];
+    feasibilityCache[hash & (FEASIBILITY_CACHE_SIZE - 1)] = entry;
+    feasibilityCacheEntries++;
+    return entry;
 }
 
-void handleAngleAssignment() {
-    assignmentCount++;
-    createSystem();
-    if (firstCheckOfSystem()) {
-        simplifySystem();
-        solveSystem();
-    } else {
-        rejectedByCoefficientDiff++;
-        if (printUnsolvableSystems || writeHammingDistanceUnsolvedSystems) {
-            simplifySystem();
-            printSystem();
-        }
-    }
-#ifdef _DEBUG
-    printSystem();
-#endif
+FEASIBILITY_CACHE_ENTRY *findCachedSystem(){
+    return findCachedSystemEntry(systemKey, systemKeyLength, nf, getSystemMode(), systemKeyHash);
 }
 
-boolean checkPartialSystem(int currentFace) {
-    int i, j;
+void storeCachedSystem(boolean isFeasible){
+    insertCachedSystemEntry(systemKey, systemKeyLength, nf, getSystemMode(),
+            systemKeyHash, isFeasible, angleValues);
+}
 
-    //reset array and count number of degree 3 types
-    int degreeThreeVertexTypeCount = 0;
-    int type1, type2;
-    for (i = 0; i < nv; i++) {
-        isDuplicateEquation[i] = FALSE;
-        if(degree[i]==3 && vertexCompletedAfterFace[i]<currentFace){
-            int currentType = degreeThreeVertexTypes[i] = getDegreeThreeVertexType(i);
-            if(degreeThreeVertexTypeCount == 0){
-                type1 = currentType;
-                degreeThreeVertexTypeCount = 1;
-            } else if(degreeThreeVertexTypeCount == 1){
-                if(type1 != currentType){
-                    type2 = currentType;
-                    degreeThreeVertexTypeCount = 2;
-                }
-            } else { //(degreeThreeVertexTypeCount == 2)
-                if(type1 != currentType && type2 != currentType){
-                    //at most two different types of degree three vertices
-                    return FALSE;
-                }
-            }
-        } else {
-            degreeThreeVertexTypes[i] = -1;
+//////////////////////////////////////////////////////////////////////////////
+
+/* Persistent feasibility cache that is shared between runs and processes.
+ * 
+ * The cache file is mapped in memory and consists of a header followed by
+ * records that are only ever appended. The file is created sparse with a fixed
+ * capacity, so that it never needs to be remapped. A process appends a record
+ * by atomically storing its size in the first free slot, i.e. where the size
+ * is still 0, then the contents, and finally marking the record as committed.
+ * The size is stored before anything else, so a writer that is killed while
+ * appending leaves a record that readers and other writers can step over. The
+ * end in the header is advanced by the writer of the record or by any other
+ * writer that finds the slot taken. Readers stop at a slot without a size, and
+ * skip records that are not committed. Records are loaded into the in-process
+ * cache, which serves as the index, so each record is only read once by each
+ * process.
+ */
+
+#define PERSISTENT_CACHE_MAGIC 0x51435453u //"STCQ"
+#define PERSISTENT_CACHE_VERSION 2
+#define PERSISTENT_CACHE_COMMITTED 0x4b4f4b4fu
+#define PERSISTENT_CACHE_CAPACITY (1ULL<<30)
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long int end; //offset of the first free slot, or of a record just before it
+} PERSISTENT_CACHE_HEADER;
+
+typedef struct {
+    unsigned int size; //size of the record in bytes, stored after reserving space
+    unsigned int committed; //set to PERSISTENT_CACHE_COMMITTED when the record is complete
+    int faceCount;
+    int mode;
+    int equationCount;
+    int isFeasible;
+    RATIONAL angleValues[ANGLE_COUNT];
+    PACKED_EQUATION equations[];
+} PERSISTENT_CACHE_RECORD;
+
+#define PERSISTENT_CACHE_START ((sizeof (PERSISTENT_CACHE_HEADER) + 7) & ~7ULL)
+
+char *persistentCacheFileName = NULL;
+char *persistentCache = NULL;
+THREAD_LOCAL unsigned long long int persistentCacheScanned = PERSISTENT_CACHE_START;
+THREAD_LOCAL boolean persistentCacheIsFull = FALSE;
+
+THREAD_LOCAL unsigned long long int persistentCacheHits = 0;
+THREAD_LOCAL unsigned long long int persistentCacheRecordsLoaded = 0;
+THREAD_LOCAL unsigned long long int persistentCacheRecordsWritten = 0;
+
+void openPersistentCache(){
+    struct stat fileStatus;
+    int fd = open(persistentCacheFileName, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open cache file %s -- exiting!\n", persistentCacheFileName);
+        exit(1);
+    }
+    if (fstat(fd, &fileStatus) != 0) {
+        fprintf(stderr, "Could not stat cache file %s -- exiting!\n", persistentCacheFileName);
+        exit(1);
+    }
+    if (fileStatus.st_size < PERSISTENT_CACHE_CAPACITY) {
+        //concurrent processes all grow the file to the same size
+        if (ftruncate(fd, PERSISTENT_CACHE_CAPACITY) != 0) {
+            fprintf(stderr, "Could not resize cache file %s -- exiting!\n", persistentCacheFileName);
+            exit(1);
         }
     }
-    duplicateEquationCount = 0;
+    persistentCache = mmap(NULL, PERSISTENT_CACHE_CAPACITY, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (persistentCache == MAP_FAILED) {
+        fprintf(stderr, "Could not map cache file %s -- exiting!\n", persistentCacheFileName);
+        exit(1);
+    }
+    close(fd);
     
-    if(degreeThreeVertexTypeCount == 2){
-        if(!degreeThreeTypesCompatibility[type1][type2]){
-            return FALSE;
-        }
-        if(degreeThreeTypesCombinationVertexLowerBound[type1][type2]>nv){
-            return FALSE;
-        }
-        if(degreeThreeTypesCombinationVertexUpperBound[type1][type2]<nv){
-            return FALSE;
-        }
+    PERSISTENT_CACHE_HEADER *header = (PERSISTENT_CACHE_HEADER *) persistentCache;
+    if (__sync_bool_compare_and_swap(&(header->magic), 0, PERSISTENT_CACHE_MAGIC)) {
+        header->version = PERSISTENT_CACHE_VERSION;
+    }
+    __sync_bool_compare_and_swap(&(header->end), 0, PERSISTENT_CACHE_START);
+    if (header->magic != PERSISTENT_CACHE_MAGIC ||
+            (header->version != 0 && header->version != PERSISTENT_CACHE_VERSION)) {
+        fprintf(stderr, "File %s is not a compatible cache file -- exiting!\n", persistentCacheFileName);
+        exit(1);
     }
+}
 
-    for (i = 0; i < nv - 1; i++) {
-        if (vertexCompletedAfterFace[i]>=currentFace) continue;
-        if (isDuplicateEquation[i]) continue;
-        /*
-         * this equation is already a duplicate itself, so any equation
-         * that would be at Hamming distance 1 of this equation is also
-         * at Hamming Distance of that earlier equation.
-         */
-        for (j = i + 1; j < nv; j++) {
-            if (vertexCompletedAfterFace[j]>=currentFace) continue;
-            if (isDuplicateEquation[j]) continue;
-            /*
-             * this equation is already a duplicate, so any equation
-             * that would be at Hamming distance 1 of this equation is also
-             * at Hamming Distance of that earlier equation.
-             */
-            
-            int diffAlpha = alphaCount[i] - alphaCount[j];
-            int diffBeta = betaCount[i] - betaCount[j];
-            int diffGamma = gammaCount[i] - gammaCount[j];
-            int diffDelta = deltaCount[i] - deltaCount[j];
-            
-            int hammingDistance = 0;
-            if (diffAlpha != 0) hammingDistance++;
-            if (diffBeta != 0) hammingDistance++;
-            if (diffGamma != 0) hammingDistance++;
-            if (diffDelta != 0) hammingDistance++;
-            if (hammingDistance == 0) {
-                // if we get here, then equation j is a duplicate of i
-                isDuplicateEquation[j] = TRUE;
-                duplicateEquationCount++;
-            } else {
-                if((diffAlpha<=0 && diffBeta<=0 && diffGamma<=0 && diffDelta<=0) || (diffAlpha>=0 && diffBeta>=0 && diffGamma>=0 && diffDelta>=0)){
-                    return FALSE;
-                }
-                if(diffAlpha==-diffGamma && diffBeta==0 && diffDelta==0){
-                    //alpha==gamma
-                    return FALSE;
-                }
-                if(diffAlpha==-diffDelta && diffGamma==0 && diffBeta==0){
-                    //alpha==delta
-                    return FALSE;
-                }
-                if(diffBeta==-diffGamma && diffAlpha==0 && diffDelta==0){
-                    //beta==gamma
-                    return FALSE;
-                }
-                if(diffBeta==-diffDelta && diffGamma==0 && diffAlpha==0){
-                    //beta==delta
-                    return FALSE;
+void closePersistentCache(){
+    if (persistentCache != NULL) {
+        munmap(persistentCache, PERSISTENT_CACHE_CAPACITY);
+        persistentCache = NULL;
+    }
+}
+
+/* Loads all records that were appended since the last call into the in-process
+ * cache.
+ */
+void loadPersistentCache(){
+    while (persistentCacheScanned + sizeof (PERSISTENT_CACHE_RECORD) <= PERSISTENT_CACHE_CAPACITY) {
+        volatile PERSISTENT_CACHE_RECORD *record =
+                (PERSISTENT_CACHE_RECORD *) (persistentCache + persistentCacheScanned);
+        unsigned int size = record->size;
+        if (size == 0) {
+            //the first free slot
+            return;
+        }
+        if (record->committed == PERSISTENT_CACHE_COMMITTED) {
+            __sync_synchronize();
+            PACKED_EQUATION *equations = (PACKED_EQUATION *) record->equations;
+            unsigned int hash = hashSystemKey(equations, record->equationCount,
+                    record->faceCount, record->mode);
+            if (findCachedSystemEntry(equations, record->equationCount, record->faceCount,
+                    record->mode, hash) == NULL) {
+                FEASIBILITY_CACHE_ENTRY *entry = insertCachedSystemEntry(equations,
+                        record->equationCount, record->faceCount, record->mode, hash,
+                        record->isFeasible, (RATIONAL *) record->angleValues);
+                if (entry != NULL) {
+                    entry->isPersistent = TRUE;
                 }
+                persistentCacheRecordsLoaded++;
             }
         }
+        //records that are not committed are skipped
+        persistentCacheScanned += size;
     }
-    return TRUE;
 }
 
-boolean checkSTCQ4Assignment(int currentFace){
-    //TODO: avoid checking the same face multiple times
-    //TODO: check efficiency of this method!!
+void appendPersistentCache(boolean isFeasible){
+    PERSISTENT_CACHE_HEADER *header = (PERSISTENT_CACHE_HEADER *) persistentCache;
+    unsigned int size = (sizeof (PERSISTENT_CACHE_RECORD) +
+            sizeof (PACKED_EQUATION)*systemKeyLength + 7) & ~7u;
     
-    //check that a c-edge is always next to a c-edge
+    unsigned long long int offset;
+    PERSISTENT_CACHE_RECORD *record;
+    
+    if (persistentCacheIsFull) return;
+    
+    //take the first free slot by storing the size in it
+    while (TRUE) {
+        offset = header->end;
+        if (offset + size > PERSISTENT_CACHE_CAPACITY) {
+            persistentCacheIsFull = TRUE;
+            return;
+        }
+        record = (PERSISTENT_CACHE_RECORD *) (persistentCache + offset);
+        if (__sync_bool_compare_and_swap(&(record->size), 0, size)) {
+            break;
+        }
+        //another writer has taken the slot, but maybe not yet advanced the end
+        __sync_bool_compare_and_swap(&(header->end), offset, offset + record->size);
+    }
+    __sync_bool_compare_and_swap(&(header->end), offset, offset + size);
+    
+    //a writer that is killed here leaves a slot that is never committed
+    TEST_KILL_HOOK(persistentCacheRecordsWritten);
+    record->faceCount = nf;
+    record->mode = getSystemMode();
+    record->equationCount = systemKeyLength;
+    record->isFeasible = isFeasible;
+    memcpy(record->angleValues, angleValues, sizeof (RATIONAL)*ANGLE_COUNT);
+    memcpy(record->equations, systemKey, sizeof (PACKED_EQUATION)*systemKeyLength);
+    __sync_synchronize();
+    record->committed = PERSISTENT_CACHE_COMMITTED;
+    persistentCacheRecordsWritten++;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* Solves the current system, but first checks whether the same system was
+ * already solved before in this run, or by another run that uses the same
+ * cache file.
+ */
+void solveSystemUsingCache(){
+    FEASIBILITY_CACHE_ENTRY *entry;
+    
+    computeSystemKey();
+    entry = findCachedSystem();
+    if (entry == NULL && persistentCache != NULL) {
+        loadPersistentCache();
+        entry = findCachedSystem();
+    }
+    if (entry != NULL) {
+        feasibilityCacheHits++;
+        if (entry->isPersistent) {
+            persistentCacheHits++;
+        }
+        memcpy(angleValues, entry->angleValues, sizeof (RATIONAL)*ANGLE_COUNT);
+        handleSystemVerdict(entry->isFeasible);
+    } else {
+        feasibilityCacheMisses++;
+        boolean isFeasible = solveSystem();
+        storeCachedSystem(isFeasible);
+        if (persistentCache != NULL) {
+            appendPersistentCache(isFeasible);
+        }
+    }
+}
+
+THREAD_LOCAL unsigned long long int assignmentCount = 0;
+
+/* Adds the angles of the face to the system, starting from its matching edge
+ * in the given direction.
+ */
+void addAnglesOfFace(int face, int direction) {
+    EDGE *e1 = matchingEdges[face];
+    EDGE *e2 = e1->inverse->prev;
+    EDGE *e3 = e2->inverse->prev;
+    EDGE *e4 = e3->inverse->prev;
+
+    //assert: e1 = e4->inverse->prev;
+    if (direction) {
+        vertexEquation[e1->end] += ALPHA_UNIT;
+        vertexEquation[e2->end] += BETA_UNIT;
+        vertexEquation[e3->end] += GAMMA_UNIT;
+        vertexEquation[e4->end] += DELTA_UNIT;
+        e2->angle = 0;
+        e3->angle = 1;
+        e4->angle = 2;
+        e1->angle = 3;
+    } else {
+        vertexEquation[e4->end] += ALPHA_UNIT;
+        vertexEquation[e3->end] += BETA_UNIT;
+        vertexEquation[e2->end] += GAMMA_UNIT;
+        vertexEquation[e1->end] += DELTA_UNIT;
+        e1->angle = 0;
+        e4->angle = 1;
+        e3->angle = 2;
+        e2->angle = 3;
+    }
+}
+
+/* Removes the angles of the face from the system. The angle labels of the
+ * edges are left as they are, since they will be overwritten before they are
+ * used again.
+ */
+void removeAnglesOfFace(int face, int direction) {
+    EDGE *e1 = matchingEdges[face];
+    EDGE *e2 = e1->inverse->prev;
+    EDGE *e3 = e2->inverse->prev;
+    EDGE *e4 = e3->inverse->prev;
+
+    if (direction) {
+        vertexEquation[e1->end] -= ALPHA_UNIT;
+        vertexEquation[e2->end] -= BETA_UNIT;
+        vertexEquation[e3->end] -= GAMMA_UNIT;
+        vertexEquation[e4->end] -= DELTA_UNIT;
+    } else {
+        vertexEquation[e4->end] -= ALPHA_UNIT;
+        vertexEquation[e3->end] -= BETA_UNIT;
+        vertexEquation[e2->end] -= GAMMA_UNIT;
+        vertexEquation[e1->end] -= DELTA_UNIT;
+    }
+}
+
+/* Adds the angles of the face at the given position in orderedFaces to the
+ * system, according to the direction stored for that position.
+ */
+void addFaceAngles(int i) {
+    addAnglesOfFace(orderedFaces[i], angleAssigmentDirection[i]);
+    faceDecided[orderedFaces[i]] = TRUE;
+}
+
+void removeFaceAngles(int i) {
+    removeAnglesOfFace(orderedFaces[i], angleAssigmentDirection[i]);
+    faceDecided[orderedFaces[i]] = FALSE;
+}
+
+/* The distinct equations of the completed vertices are maintained incrementally.
+ * Vertices are completed in a fixed order (see orderFaces()), so when the
+ * direction of a face is chosen, only the vertices that are completed by that
+ * face need to be compared to the distinct equations found so far. The state
+ * is restored when backtracking by resetting the counts below to their
+ * previous values.
+ */
+
+THREAD_LOCAL PACKED_EQUATION distinctEquations[MAXN + 8]; //padded for the vectorized comparisons
+THREAD_LOCAL int distinctEquationCount = 0;
+
+THREAD_LOCAL int degreeThreeTypeCount = 0;
+THREAD_LOCAL int degreeThreeType1, degreeThreeType2;
+
+typedef struct {
+    int distinctEquationCount;
+    int duplicateEquationCount;
+    int degreeThreeTypeCount;
+    int degreeThreeType1;
+    int degreeThreeType2;
+} EQUATION_SET_STATE;
+
+void saveEquationSetState(EQUATION_SET_STATE *state) {
+    state->distinctEquationCount = distinctEquationCount;
+    state->duplicateEquationCount = duplicateEquationCount;
+    state->degreeThreeTypeCount = degreeThreeTypeCount;
+    state->degreeThreeType1 = degreeThreeType1;
+    state->degreeThreeType2 = degreeThreeType2;
+}
+
+void restoreEquationSetState(EQUATION_SET_STATE *state) {
+    distinctEquationCount = state->distinctEquationCount;
+    duplicateEquationCount = state->duplicateEquationCount;
+    degreeThreeTypeCount = state->degreeThreeTypeCount;
+    degreeThreeType1 = state->degreeThreeType1;
+    degreeThreeType2 = state->degreeThreeType2;
+}
+
+void clearEquationSet() {
+    distinctEquationCount = 0;
+    duplicateEquationCount = 0;
+    degreeThreeTypeCount = 0;
+}
+
+void clearSystem() {
+    int i;
+    for (i = 0; i < nv; i++) {
+        vertexEquation[i] = 0;
+    }
+    clearEquationSet();
+}
+
+/* Compares the equation to the given distinct equations.
+ * 
+ * If the system contains two equations such that one is componentwise at least
+ * the other one, or two equations that would force alpha==gamma, alpha==delta,
+ * beta==gamma or beta==delta, the equation is rejected. If the equation is equal
+ * to one of the distinct equations, it is a duplicate.
+ * 
+ * Since the distinct equations are pairwise compatible, an equation that is a
+ * duplicate of one of them can't be rejected by any of the others, so the order
+ * in which the equations are compared does not matter.
+ */
+#define EQUATION_REJECTED 0
+#define EQUATION_NEW 1
+#define EQUATION_DUPLICATE 2
+
+int compareEquationScalar(PACKED_EQUATION equation, PACKED_EQUATION *equations, int count) {
+    int j;
+    
+    for (j = 0; j < count; j++) {
+        PACKED_EQUATION other = equations[j];
+        int diffAlpha = (int) (equation >> 24) - (int) (other >> 24);
+        int diffBeta = (int) ((equation >> 16) & 0xFF) - (int) ((other >> 16) & 0xFF);
+        int diffGamma = (int) ((equation >> 8) & 0xFF) - (int) ((other >> 8) & 0xFF);
+        int diffDelta = (int) (equation & 0xFF) - (int) (other & 0xFF);
+
+        if (!diffAlpha && !diffBeta && !diffGamma && !diffDelta) {
+            return EQUATION_DUPLICATE;
+        }
+        if((diffAlpha<=0 && diffBeta<=0 && diffGamma<=0 && diffDelta<=0) || (diffAlpha>=0 && diffBeta>=0 && diffGamma>=0 && diffDelta>=0)){
+            return EQUATION_REJECTED;
+        }
+        if(diffAlpha==-diffGamma && diffBeta==0 && diffDelta==0){
+            //alpha==gamma
+            return EQUATION_REJECTED;
+        }
+        if(diffAlpha==-diffDelta && diffGamma==0 && diffBeta==0){
+            //alpha==delta
+            return EQUATION_REJECTED;
+        }
+        if(diffBeta==-diffGamma && diffAlpha==0 && diffDelta==0){
+            //beta==gamma
+            return EQUATION_REJECTED;
+        }
+        if(diffBeta==-diffDelta && diffGamma==0 && diffAlpha==0){
+            //beta==delta
+            return EQUATION_REJECTED;
+        }
+    }
+    return EQUATION_NEW;
+}
+
+#if !defined(NOSIMD) && defined(__GNUC__) && defined(__SSE2__)
+
+/* The vectorized versions compare the equation to 4 (SSE2) or 8 (AVX2) packed
+ * equations at once. Within each 32-bit lane:
+ *  - componentwise dominance is tested by comparing the bytewise maximum
+ *    (or minimum) of both equations to the equation itself,
+ *  - the sums a+c and b+d are found in bytes 1 and 0 of x + (x >> 16), the
+ *    sum b+c in byte 1 of x + (x >> 8) and the sum a+d in byte 0 of x + (x >> 24).
+ * All these sums are less than 256, so there is no carry between bytes.
+ * The array of equations needs to be padded to a multiple of 8 equations.
+ */
+
+#include <immintrin.h>
+
+int compareEquationSSE2(PACKED_EQUATION equation, PACKED_EQUATION *equations, int count) {
+    int j;
+    __m128i e = _mm_set1_epi32(equation);
+    __m128i e8 = _mm_add_epi32(e, _mm_srli_epi32(e, 8));
+    __m128i e16 = _mm_add_epi32(e, _mm_srli_epi32(e, 16));
+    __m128i e24 = _mm_add_epi32(e, _mm_srli_epi32(e, 24));
+    __m128i lowByte = _mm_set1_epi32(0xFF);
+    __m128i zero = _mm_setzero_si128();
+    
+    for (j = 0; j < count; j += 4) {
+        __m128i o = _mm_loadu_si128((__m128i *) (equations + j));
+        int laneMask = count - j >= 4 ? 0xF : (1 << (count - j)) - 1;
+        
+        __m128i duplicate = _mm_cmpeq_epi32(e, o);
+        if (_mm_movemask_ps(_mm_castsi128_ps(duplicate)) & laneMask) {
+            return EQUATION_DUPLICATE;
+        }
+        
+        __m128i dominates = _mm_or_si128(
+                _mm_cmpeq_epi32(_mm_max_epu8(e, o), e),
+                _mm_cmpeq_epi32(_mm_min_epu8(e, o), e));
+        
+        __m128i equal = _mm_cmpeq_epi8(e, o);
+        __m128i equal8 = _mm_cmpeq_epi8(e8, _mm_add_epi32(o, _mm_srli_epi32(o, 8)));
+        __m128i equal16 = _mm_cmpeq_epi8(e16, _mm_add_epi32(o, _mm_srli_epi32(o, 16)));
+        __m128i equal24 = _mm_cmpeq_epi8(e24, _mm_add_epi32(o, _mm_srli_epi32(o, 24)));
+        __m128i equalA = _mm_srli_epi32(equal, 24);
+        __m128i equalB = _mm_srli_epi32(equal, 16);
+        __m128i equalC = _mm_srli_epi32(equal, 8);
+        
+        //alpha==gamma, alpha==delta, beta==gamma and beta==delta (all in byte 0)
+        __m128i rules = _mm_and_si128(_mm_and_si128(equalB, equal), _mm_srli_epi32(equal16, 8));
+        rules = _mm_or_si128(rules, _mm_and_si128(_mm_and_si128(equalB, equalC), equal24));
+        rules = _mm_or_si128(rules, _mm_and_si128(_mm_and_si128(equalA, equal), _mm_srli_epi32(equal8, 8)));
+        rules = _mm_or_si128(rules, _mm_and_si128(_mm_and_si128(equalA, equalC), equal16));
+        rules = _mm_cmpeq_epi32(_mm_and_si128(rules, lowByte), zero);
+        
+        int rejected = _mm_movemask_ps(_mm_castsi128_ps(dominates)) |
+                (~_mm_movemask_ps(_mm_castsi128_ps(rules)) & 0xF);
+        if (rejected & laneMask) {
+            return EQUATION_REJECTED;
+        }
+    }
+    return EQUATION_NEW;
+}
+
+__attribute__((target("avx2")))
+int compareEquationAVX2(PACKED_EQUATION equation, PACKED_EQUATION *equations, int count) {
+    int j;
+    __m256i e = _mm256_set1_epi32(equation);
+    __m256i e8 = _mm256_add_epi32(e, _mm256_srli_epi32(e, 8));
+    __m256i e16 = _mm256_add_epi32(e, _mm256_srli_epi32(e, 16));
+    __m256i e24 = _mm256_add_epi32(e, _mm256_srli_epi32(e, 24));
+    __m256i lowByte = _mm256_set1_epi32(0xFF);
+    __m256i zero = _mm256_setzero_si256();
+    
+    for (j = 0; j < count; j += 8) {
+        __m256i o = _mm256_loadu_si256((__m256i *) (equations + j));
+        int laneMask = count - j >= 8 ? 0xFF : (1 << (count - j)) - 1;
+        
+        __m256i duplicate = _mm256_cmpeq_epi32(e, o);
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(duplicate)) & laneMask) {
+            return EQUATION_DUPLICATE;
+        }
+        
+        __m256i dominates = _mm256_or_si256(
+                _mm256_cmpeq_epi32(_mm256_max_epu8(e, o), e),
+                _mm256_cmpeq_epi32(_mm256_min_epu8(e, o), e));
+        
+        __m256i equal = _mm256_cmpeq_epi8(e, o);
+        __m256i equal8 = _mm256_cmpeq_epi8(e8, _mm256_add_epi32(o, _mm256_srli_epi32(o, 8)));
+        __m256i equal16 = _mm256_cmpeq_epi8(e16, _mm256_add_epi32(o, _mm256_srli_epi32(o, 16)));
+        __m256i equal24 = _mm256_cmpeq_epi8(e24, _mm256_add_epi32(o, _mm256_srli_epi32(o, 24)));
+        __m256i equalA = _mm256_srli_epi32(equal, 24);
+        __m256i equalB = _mm256_srli_epi32(equal, 16);
+        __m256i equalC = _mm256_srli_epi32(equal, 8);
+        
+        //alpha==gamma, alpha==delta, beta==gamma and beta==delta (all in byte 0)
+        __m256i rules = _mm256_and_si256(_mm256_and_si256(equalB, equal), _mm256_srli_epi32(equal16, 8));
+        rules = _mm256_or_si256(rules, _mm256_and_si256(_mm256_and_si256(equalB, equalC), equal24));
+        rules = _mm256_or_si256(rules, _mm256_and_si256(_mm256_and_si256(equalA, equal), _mm256_srli_epi32(equal8, 8)));
+        rules = _mm256_or_si256(rules, _mm256_and_si256(_mm256_and_si256(equalA, equalC), equal16));
+        rules = _mm256_cmpeq_epi32(_mm256_and_si256(rules, lowByte), zero);
+        
+        int rejected = _mm256_movemask_ps(_mm256_castsi256_ps(dominates)) |
+                (~_mm256_movemask_ps(_mm256_castsi256_ps(rules)) & 0xFF);
+        if (rejected & laneMask) {
+            return EQUATION_REJECTED;
+        }
+    }
+    return EQUATION_NEW;
+}
+
+#endif
+
+int (*compareEquation)(PACKED_EQUATION, PACKED_EQUATION *, int) = compareEquationScalar;
+
+/* Selects the fastest version of compareEquation that is supported by the CPU.
+ */
+void selectEquationComparison(){
+#if !defined(NOSIMD) && defined(__GNUC__) && defined(__SSE2__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        compareEquation = compareEquationAVX2;
+    } else {
+        compareEquation = compareEquationSSE2;
+    }
+#endif
+}
+
+/* Adds the equation of the completed vertex v to the set of distinct equations.
+ * Returns FALSE if the system can be rejected.
+ */
+boolean addCompletedVertexEquation(int v) {
+    switch (compareEquation(vertexEquation[v], distinctEquations, distinctEquationCount)) {
+        case EQUATION_DUPLICATE:
+            isDuplicateEquation[v] = TRUE;
+            duplicateEquationCount++;
+            return TRUE;
+        case EQUATION_NEW:
+            isDuplicateEquation[v] = FALSE;
+            distinctEquations[distinctEquationCount++] = vertexEquation[v];
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* Updates the types of the completed degree 3 vertices with the completed
+ * vertex v. Returns FALSE if the types that occur are not compatible.
+ */
+boolean addCompletedVertexDegreeThreeType(int v) {
+    int currentType = degreeThreeVertexTypes[v] = getDegreeThreeVertexType(v);
+    if(degreeThreeTypeCount == 0){
+        degreeThreeType1 = currentType;
+        degreeThreeTypeCount = 1;
+        return TRUE;
+    } else if(degreeThreeTypeCount == 1){
+        if(degreeThreeType1 == currentType){
+            return TRUE;
+        }
+        degreeThreeType2 = currentType;
+        degreeThreeTypeCount = 2;
+        if(!degreeThreeTypesCompatibility[degreeThreeType1][degreeThreeType2]){
+            return FALSE;
+        }
+        if(degreeThreeTypesCombinationVertexLowerBound[degreeThreeType1][degreeThreeType2]>nv){
+            return FALSE;
+        }
+        if(degreeThreeTypesCombinationVertexUpperBound[degreeThreeType1][degreeThreeType2]<nv){
+            return FALSE;
+        }
+        return TRUE;
+    } else { //(degreeThreeTypeCount == 2)
+        //at most two different types of degree three vertices
+        return degreeThreeType1 == currentType || degreeThreeType2 == currentType;
+    }
+}
+
+/* Adds the vertices that are completed by the face at the given position in
+ * orderedFaces. Returns FALSE if the system can be rejected. The restrictions
+ * on the degree 3 vertices only apply to convex tilings.
+ */
+boolean addCompletedVertices(int face) {
+    int i;
+    for (i = completedVerticesStart[face]; i < completedVerticesStart[face + 1]; i++) {
+        int v = completedVertices[i];
+        if (!addCompletedVertexEquation(v)) {
+            return FALSE;
+        }
+        if (boundAngleAssignments && degree[v] == 3 &&
+                !addCompletedVertexDegreeThreeType(v)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void handleAngleAssignment() {
+    assignmentCount++;
+    simplifySystem();
+    if (useFeasibilityCache) {
+        solveSystemUsingCache();
+    } else {
+        solveSystem();
+    }
+#ifdef _DEBUG
+    printSystem();
+#endif
+}
+
+void handleRejectedAngleAssignment() {
+    assignmentCount++;
+    rejectedByCoefficientDiff++;
+    if (printUnsolvableSystems || writeHammingDistanceUnsolvedSystems) {
+        simplifySystem();
+        pthread_mutex_lock(&outputLock);
+        printSystem();
+        pthread_mutex_unlock(&outputLock);
+    }
+}
+
+boolean checkSTCQ4Assignment(int currentFace){
+    //TODO: avoid checking the same face multiple times
+    //TODO: check efficiency of this method!!
+    
+    //check that a c-edge is always next to a c-edge
     int i;
     
     for(i = 0; i < currentFace; i++){
@@ -1547,9 +2641,10 @@ boolean checkSTCQ4Assignment(int currentFace){
         } else {
             fn = em->inverse->prev->inverse->rightface; // neighbouring face along c-edge
         }
-        if(faceRank[fn] < currentFace && faceRank[fn] < i){
+        if(faceRank[fn] < currentFace){
             //if angles are fixed for the neighbouring face
-            //second part is to avoid comparing the same pair twice
+            //both orders of each pair need to be checked: the c-edge of the
+            //neighbouring face has to be the c-edge of this face
 
             EDGE *efn = matchingEdges[fn];
             //find face next to neighbouring face
@@ -1569,33 +2664,243 @@ boolean checkSTCQ4Assignment(int currentFace){
 }
 
 void assignAnglesForCurrentPerfectMatchingRecursion(int currentFace) {
+    EQUATION_SET_STATE state;
+    
     if(generateSTCQ4 && !checkSTCQ4Assignment(currentFace)){
         return;
     }
+    if(!isPossiblyCanonicalAngleAssignment()){
+        return;
+    }
+    saveEquationSetState(&state);
+    if(!addCompletedVertices(currentFace - 1)){
+        if (currentFace == nv - 2) {
+            handleRejectedAngleAssignment();
+        }
+        restoreEquationSetState(&state);
+        return;
+    }
     if (currentFace == nv - 2) {
         handleAngleAssignment();
     } else {
-        if(boundAngleAssignments && checkVerticesAfterFace[currentFace]){
-            createPartialSystem(currentFace);
-            if(!checkPartialSystem(currentFace)){
-                return;
-            }
-        }
         angleAssigmentDirection[currentFace] = 0;
+        addFaceAngles(currentFace);
         assignAnglesForCurrentPerfectMatchingRecursion(currentFace + 1);
+        removeFaceAngles(currentFace);
         angleAssigmentDirection[currentFace] = 1;
+        addFaceAngles(currentFace);
         assignAnglesForCurrentPerfectMatchingRecursion(currentFace + 1);
+        removeFaceAngles(currentFace);
     }
+    restoreEquationSetState(&state);
 }
 
+/* The angle counts are maintained incrementally during the recursion: each
+ * face adds its angles when its direction is chosen and removes them again
+ * when backtracking.
+ */
 void assignAnglesForCurrentPerfectMatching() {
     angleAssigmentDirection[0] = 0;
+    addFaceAngles(0);
     assignAnglesForCurrentPerfectMatchingRecursion(1);
+    removeFaceAngles(0);
     angleAssigmentDirection[0] = 1;
+    addFaceAngles(0);
     assignAnglesForCurrentPerfectMatchingRecursion(1);
+    removeFaceAngles(0);
+}
+
+THREAD_LOCAL int matchingCount = 0;
+
+/* The faces in the order in which their matching edge was chosen by
+ * matchFirstFace() and matchNextFace().
+ */
+THREAD_LOCAL int matchingOrder[MAXF];
+
+//TRUE if the current search can hand subtrees to other threads
+THREAD_LOCAL boolean splitSearch = FALSE;
+
+//TRUE if only a share of the subtrees of the current search should be handled
+THREAD_LOCAL boolean partitionSearch = FALSE;
+
+THREAD_LOCAL unsigned long long int currentQuadrangulationNumber;
+THREAD_LOCAL unsigned long long int subtreeCount; //subtrees at the split depth so far
+
+unsigned long long int getOffsetIndexCount();
+
+/* Returns the number of quadrangulations in the blocks before the given block.
+ */
+unsigned long long int getBlockStart(unsigned long long int block){
+    unsigned long long int count = getOffsetIndexCount();
+    return (count / partitionModulus) * block + (count % partitionModulus) * block / partitionModulus;
+}
+
+boolean isQuadrangulationInShare(unsigned long long int number){
+    if(splitDepth > 0){
+        return TRUE;
+    } else if(isBlockPartition){
+        return number > getBlockStart(partitionResidue) && number <= getBlockStart(partitionResidue + 1);
+    }
+    return (number - 1) % partitionModulus == partitionResidue;
+}
+
+/* Returns the position in filterRanges of the first range that doesn't end
+ * before the given number.
+ */
+int findFilterRange(unsigned long long int number){
+    int low = 0, high = filterRangeCount;
+    while(low < high){
+        int middle = (low + high) / 2;
+        if(filterRanges[middle].last < number){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+boolean isQuadrangulationSelected(unsigned long long int number){
+    if(filterRangeCount == 0){
+        return TRUE;
+    }
+    int i = findFilterRange(number);
+    return i < filterRangeCount && filterRanges[i].first <= number;
+}
+
+/* Returns the smallest number from the given number on of a quadrangulation
+ * that is selected and in the share, or 0 if there is none among the count
+ * quadrangulations of the input.
+ */
+unsigned long long int findNextHandledQuadrangulation(unsigned long long int number,
+        unsigned long long int count){
+    unsigned long long int first = 1, last = count, candidate, end;
+    int i = 0;
+    
+    if(splitDepth == 0 && isBlockPartition){
+        first = getBlockStart(partitionResidue) + 1;
+        last = getBlockStart(partitionResidue + 1);
+    }
+    if(filterRangeCount > 0){
+        i = findFilterRange(number);
+    }
+    for(; filterRangeCount == 0 ? i < 1 : i < filterRangeCount; i++){
+        candidate = number > first ? number : first;
+        end = last;
+        if(filterRangeCount > 0){
+            if(candidate < filterRanges[i].first){
+                candidate = filterRanges[i].first;
+            }
+            if(end > filterRanges[i].last){
+                end = filterRanges[i].last;
+            }
+        }
+        if(splitDepth == 0 && !isBlockPartition){
+            //the next number with (number - 1) % mod == res
+            candidate += (partitionResidue + partitionModulus - (candidate - 1) % partitionModulus) % partitionModulus;
+        }
+        if(candidate <= end){
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+int compareFilterRanges(const void *a, const void *b){
+    const FILTER_RANGE *range1 = a, *range2 = b;
+    if(range1->first != range2->first){
+        return range1->first < range2->first ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Parses a list of numbers and ranges like 5,10-20 for -f. Returns FALSE if
+ * the list is not valid.
+ */
+boolean parseFilter(char *list){
+    int i, count = 1;
+    char *position;
+    size_t descriptionLength;
+    
+    for(position = list; *position; position++){
+        if(*position == ','){
+            count++;
+        }
+    }
+    filterRanges = (FILTER_RANGE *)malloc(count * sizeof(FILTER_RANGE));
+    
+    position = list;
+    for(i = 0; i < count; i++){
+        char *end;
+        if(*position < '0' || *position > '9'){
+            return FALSE;
+        }
+        filterRanges[i].first = filterRanges[i].last = strtoull(position, &end, 10);
+        if(*end == '-'){
+            position = end + 1;
+            if(*position < '0' || *position > '9'){
+                return FALSE;
+            }
+            filterRanges[i].last = strtoull(position, &end, 10);
+        }
+        if(filterRanges[i].first == 0 || filterRanges[i].first > filterRanges[i].last ||
+                (*end != ',' && *end != '\0')){
+            return FALSE;
+        }
+        position = end + 1;
+    }
+    
+    //sort the ranges and merge the ranges that overlap or touch
+    qsort(filterRanges, count, sizeof(FILTER_RANGE), compareFilterRanges);
+    filterRangeCount = 0;
+    for(i = 0; i < count; i++){
+        if(filterRangeCount > 0 && filterRanges[i].first <= filterRanges[filterRangeCount - 1].last + 1){
+            if(filterRanges[i].last > filterRanges[filterRangeCount - 1].last){
+                filterRanges[filterRangeCount - 1].last = filterRanges[i].last;
+            }
+        } else {
+            filterRanges[filterRangeCount++] = filterRanges[i];
+        }
+    }
+    
+    descriptionLength = filterRangeCount * 42;
+    filterDescription = (char *)malloc(descriptionLength);
+    position = filterDescription;
+    for(i = 0; i < filterRangeCount; i++){
+        if(filterRanges[i].first == filterRanges[i].last){
+            position += sprintf(position, i ? ",%llu" : "%llu", filterRanges[i].first);
+        } else {
+            position += sprintf(position, i ? ",%llu-%llu" : "%llu-%llu",
+                    filterRanges[i].first, filterRanges[i].last);
+        }
+    }
+    return TRUE;
+}
+
+boolean isSubtreeInShare(){
+    return (currentQuadrangulationNumber + subtreeCount++) % partitionModulus == partitionResidue;
+}
+
+/* Prepares the partitioning of the subtrees for the search of the given
+ * quadrangulation. If the search can't reach the split depth, the
+ * quadrangulation is assigned to a share as a whole. Returns FALSE if the
+ * quadrangulation should be skipped.
+ */
+boolean startPartitionedSearch(unsigned long long int number){
+    int maximumDepth = interleavedSearch ? nf : (nv - 2) / 2;
+    currentQuadrangulationNumber = number;
+    subtreeCount = 0;
+    partitionSearch = FALSE;
+    if(splitDepth > 0 && partitionModulus > 1){
+        if(splitDepth > maximumDepth){
+            return (number - 1) % partitionModulus == partitionResidue;
+        }
+        partitionSearch = TRUE;
+    }
+    return TRUE;
 }
 
-int matchingCount = 0;
+boolean spawnSubtask(int prefixLength);
 
 void handlePerfectMatching() {
     matchingCount++;
@@ -1603,6 +2908,10 @@ void handlePerfectMatching() {
 }
 
 void matchNextFace(int lastFace, int matchingSize) {
+    if (partitionSearch && matchingSize == splitDepth && !isSubtreeInShare()) {
+        return;
+    }
+    
     if (matchingSize == (nv - 2) / 2) {
         //Found a perfect matching
         handlePerfectMatching();
@@ -1616,7 +2925,14 @@ void matchNextFace(int lastFace, int matchingSize) {
         fprintf(stderr, "Something went terribly wrong.");
         exit(1);
     }
+    
+    if (splitSearch && matchingSize == splitDepth && spawnSubtask(matchingSize)) {
+        //this subtree is handled by another thread
+        return;
+    }
+    
     matched[nextFace] = TRUE;
+    matchingOrder[matchingSize] = nextFace;
 
     EDGE *e, *elast;
 
@@ -1642,42 +2958,267 @@ void matchNextFace(int lastFace, int matchingSize) {
     matched[nextFace] = FALSE;
 }
 
-void markEdgesAtCubicTristar(){
-    int i;
-    for(i=0; i<nv; i++){
-        if(degree[i]==3){
-            EDGE *e, *elast;
+//////////////////////////////////////////////////////////////////////////////
 
-            int isTristar = TRUE;
+/* Interleaved search: instead of first constructing a complete perfect matching
+ * and then assigning the directions, the matching edge and the direction are
+ * decided together for one face at a time. As soon as all faces at a vertex are
+ * decided, the equation of that vertex is checked, so partial matchings that
+ * can't lead to a solution are pruned. At each step the undecided face with the
+ * fewest possibilities is chosen.
+ */
 
-            e = elast = firstedge[i];
-            do {
-                if(degree[e->end]!=3){
-                    isTristar = FALSE;
-                }
-                e = e->next;
-            } while (e!=elast);
+THREAD_LOCAL int faceDirection[MAXF];
+THREAD_LOCAL int decidedFaceCount;
+THREAD_LOCAL int decidedFacesAt[MAXN]; //the number of decided faces at each vertex
+THREAD_LOCAL int decisionOrder[MAXF]; //the decided faces in the order in which they were decided
 
-            if(isTristar){
-                e = elast = firstedge[i];
-                do {
-                    e->allowedInFaceMatching = FALSE;
-                    e->inverse->prev->inverse->next->allowedInFaceMatching = FALSE;
-                    e->inverse->next->inverse->prev->allowedInFaceMatching = FALSE;
-                    e = e->next;
-                } while (e!=elast);
+/* An edge is allowed in the matching if it is allowed on the side of the face
+ * with the smallest number. This is the side from which matchNextFace() would
+ * match it.
+ */
+boolean isAllowedMatchingEdge(EDGE *e){
+    if (e->rightface < e->inverse->rightface) {
+        return e->allowedInFaceMatching;
+    } else {
+        return e->inverse->allowedInFaceMatching;
+    }
+}
+
+int countMatchingOptions(int face){
+    int count = 0;
+    EDGE *e, *elast;
+    
+    e = elast = facestart[face];
+    do {
+        if (!matched[e->inverse->rightface] && isAllowedMatchingEdge(e)) {
+            count++;
+        }
+        e = e->inverse->prev;
+    } while (e != elast);
+    return count;
+}
+
+/* Returns the face that shares the c-edge with the given decided face.
+ */
+int getCEdgeNeighbour(int face, int direction){
+    EDGE *em = matchingEdges[face];
+    if (direction) {
+        return em->next->rightface;
+    } else {
+        return em->inverse->prev->inverse->rightface;
+    }
+}
+
+/* For STCQ4 a c-edge is always next to a c-edge. Returns FALSE if deciding the
+ * face in the given direction violates this for a face that is already decided.
+ */
+boolean isCompatibleCEdge(int face, int direction){
+    int neighbour = getCEdgeNeighbour(face, direction);
+    if (faceDecided[neighbour] &&
+            getCEdgeNeighbour(neighbour, faceDirection[neighbour]) != face) {
+        return FALSE;
+    }
+    
+    EDGE *e, *elast;
+    e = elast = facestart[face];
+    do {
+        int other = e->inverse->rightface;
+        if (faceDecided[other] && other != neighbour &&
+                getCEdgeNeighbour(other, faceDirection[other]) == face) {
+            return FALSE;
+        }
+        e = e->inverse->prev;
+    } while (e != elast);
+    return TRUE;
+}
+
+/* Marks the face as decided at its vertices, and adds the equations of the
+ * vertices that are completed. Returns FALSE if the system can be rejected.
+ * The counts are updated for all vertices, even if the system is rejected.
+ */
+boolean completeVerticesAtFace(int face){
+    boolean result = TRUE;
+    EDGE *e, *elast;
+    
+    e = elast = facestart[face];
+    do {
+        int v = e->start;
+        decidedFacesAt[v]++;
+        if (result && decidedFacesAt[v] == degree[v]) {
+            if (!addCompletedVertexEquation(v) ||
+                    (boundAngleAssignments && degree[v] == 3 &&
+                     !addCompletedVertexDegreeThreeType(v))) {
+                result = FALSE;
+            }
+        }
+        e = e->inverse->prev;
+    } while (e != elast);
+    return result;
+}
+
+void uncompleteVerticesAtFace(int face){
+    EDGE *e, *elast;
+    
+    e = elast = facestart[face];
+    do {
+        decidedFacesAt[e->start]--;
+        e = e->inverse->prev;
+    } while (e != elast);
+}
+
+void decideNextFace();
+
+/* Tries both directions for the face, whose matching edge is already fixed.
+ */
+void decideFaceDirection(int face){
+    int direction;
+    EQUATION_SET_STATE state;
+    
+    for (direction = 0; direction < 2; direction++) {
+        if (generateSTCQ4 && !isCompatibleCEdge(face, direction)) {
+            continue;
+        }
+        if (partitionSearch && decidedFaceCount + 1 == splitDepth && !isSubtreeInShare()) {
+            continue;
+        }
+        saveEquationSetState(&state);
+        faceDecided[face] = TRUE;
+        faceDirection[face] = direction;
+        decidedFaceCount++;
+        decisionOrder[decidedFaceCount - 1] = face;
+        addAnglesOfFace(face, direction);
+        if (completeVerticesAtFace(face)) {
+            if (isPossiblyCanonicalAngleAssignment() &&
+                    !(splitSearch && decidedFaceCount == splitDepth &&
+                      spawnSubtask(decidedFaceCount))) {
+                decideNextFace();
             }
+        } else if (decidedFaceCount == nf) {
+            handleRejectedAngleAssignment();
         }
+        uncompleteVerticesAtFace(face);
+        removeAnglesOfFace(face, direction);
+        decidedFaceCount--;
+        faceDecided[face] = FALSE;
+        restoreEquationSetState(&state);
     }
 }
 
-int generate_perfect_matchings_in_dual() {
+void decideNextFace(){
+    int i;
+    
+    if (decidedFaceCount == nf) {
+        handleAngleAssignment();
+        return;
+    }
+    
+    //find the most constrained face
+    int bestFace = -1;
+    int bestOptionCount = MAXVAL + 1;
+    int bestCompletedCount = -1;
+    for (i = 0; i < nf; i++) {
+        if (faceDecided[i]) continue;
+        int optionCount = matched[i] ? 1 : countMatchingOptions(i);
+        if (optionCount == 0) {
+            //this face can't be matched anymore
+            return;
+        }
+        if (optionCount <= bestOptionCount) {
+            //count the vertices that would be completed by this face
+            int completedCount = 0;
+            EDGE *e, *elast;
+            e = elast = facestart[i];
+            do {
+                if (decidedFacesAt[e->start] == degree[e->start] - 1) {
+                    completedCount++;
+                }
+                e = e->inverse->prev;
+            } while (e != elast);
+            if (optionCount < bestOptionCount || completedCount > bestCompletedCount) {
+                bestFace = i;
+                bestOptionCount = optionCount;
+                bestCompletedCount = completedCount;
+            }
+        }
+    }
+    
+    if (matched[bestFace]) {
+        decideFaceDirection(bestFace);
+        return;
+    }
+    
+    EDGE *e, *elast;
+    e = elast = facestart[bestFace];
+    do {
+        int neighbour = e->inverse->rightface;
+        if (!matched[neighbour] && isAllowedMatchingEdge(e)) {
+            matched[bestFace] = matched[neighbour] = TRUE;
+            match[bestFace] = neighbour;
+            match[neighbour] = bestFace;
+            matchingEdges[bestFace] = e;
+            matchingEdges[neighbour] = e->inverse;
+            
+            decideFaceDirection(bestFace);
+            
+            matched[bestFace] = matched[neighbour] = FALSE;
+        }
+        e = e->inverse->prev;
+    } while (e != elast);
+}
+
+void clearInterleavedSearch(){
     int i;
+    for (i = 0; i < nf; i++) {
+        matched[i] = FALSE;
+        faceDecided[i] = FALSE;
+    }
+    for (i = 0; i < nv; i++) {
+        decidedFacesAt[i] = 0;
+    }
+    decidedFaceCount = 0;
+    clearSystem();
+}
 
-    matchingCount = 0;
+void startInterleavedSearch(){
+    clearInterleavedSearch();
+    decideNextFace();
+}
 
-    unsigned long long int oldSolutionCount = solvable;
+//////////////////////////////////////////////////////////////////////////////
+
+void markEdgesAtCubicTristar(){
+    int i;
+    for(i=0; i<nv; i++){
+        if(degree[i]==3){
+            EDGE *e, *elast;
+
+            int isTristar = TRUE;
+
+            e = elast = firstedge[i];
+            do {
+                if(degree[e->end]!=3){
+                    isTristar = FALSE;
+                }
+                e = e->next;
+            } while (e!=elast);
+
+            if(isTristar){
+                e = elast = firstedge[i];
+                do {
+                    e->allowedInFaceMatching = FALSE;
+                    e->inverse->prev->inverse->next->allowedInFaceMatching = FALSE;
+                    e->inverse->next->inverse->prev->allowedInFaceMatching = FALSE;
+                    e = e->next;
+                } while (e!=elast);
+            }
+        }
+    }
+}
+
+void matchFirstFace();
 
+void prepareMatchingSearch() {
     if (nf != nv - 2) {
         fprintf(stderr, "Something went horribly wrong. Maybe some wrong parameter?\nnf: %d, nv: %d\n", nf, nv);
         exit(1);
@@ -1688,11 +3229,58 @@ int generate_perfect_matchings_in_dual() {
             markEdgesAtCubicTristar();
         }
     }
+}
+
+/* Updates the statistics and the output once the search for the current
+ * quadrangulation is complete.
+ */
+void finishQuadrangulation(int matchings, boolean hasSolutions) {
+    if (!interleavedSearch) {
+        perfect_matchings_counts = increment(perfect_matchings_counts, matchings);
+    }
+
+    if (!hasSolutions) {
+        unusedGraphCount++;
+        if (unusedQuadrangulations) {
+            outputQuadrangulation();
+        }
+    } else if (usedQuadrangulations) {
+        outputQuadrangulation();
+    }
+}
+
+int generate_perfect_matchings_in_dual() {
+    matchingCount = 0;
+
+    unsigned long long int oldSolutionCount = solvable;
+
+    prepareMatchingSearch();
+
+    if (interleavedSearch) {
+        startInterleavedSearch();
+    } else {
+        matchFirstFace();
+    }
+
+    finishQuadrangulation(matchingCount, oldSolutionCount != solvable);
+
+    return 0;
+}
 
+void clearMatching() {
+    int i;
+    
     for (i = 0; i < nv - 2; i++) {
         matched[i] = FALSE;
+        faceDecided[i] = FALSE;
     }
+    clearSystem();
+}
+
+void matchFirstFace() {
+    clearMatching();
     matched[0] = TRUE;
+    matchingOrder[0] = 0;
 
     EDGE *e, *elast;
 
@@ -1714,37 +3302,30 @@ int generate_perfect_matchings_in_dual() {
         }
         e = e->inverse->prev;
     } while (e != elast);
-
-
-    perfect_matchings_counts = increment(perfect_matchings_counts, matchingCount);
-
-    if (oldSolutionCount == solvable) {
-        unusedGraphCount++;
-        if (unusedQuadrangulations) {
-            outputQuadrangulation();
-        }
-    } else if (usedQuadrangulations) {
-        outputQuadrangulation();
-    }
-
-    return 0;
 }
 
 void printSummary() {
     unsigned long long int totalPerfectMatchingsCount = 0;
     item *currentItem = perfect_matchings_counts;
-    fprintf(stderr, "Size   Count\n");
-    fprintf(stderr, "------------\n");
+    if (!interleavedSearch) {
+        fprintf(stderr, "Size   Count\n");
+        fprintf(stderr, "------------\n");
+    }
     while (currentItem != NULL) {
         fprintf(stderr, "%4d : %5d\n", currentItem->key, currentItem->value);
         totalPerfectMatchingsCount += (currentItem->value) * (currentItem->key);
         currentItem = currentItem->next;
     }
     fprintf(stderr, "\nQuadrangulations: %llu\n", numberOfQuadrangulations);
-    if(filterOnly){
-        fprintf(stderr, "Only quadrangulation %llu was used\n", filterOnly);
+    if(filterRangeCount == 1 && filterRanges[0].first == filterRanges[0].last){
+        fprintf(stderr, "Only quadrangulation %llu was used\n", filterRanges[0].first);
+    } else if(filterRangeCount > 0){
+        fprintf(stderr, "Only quadrangulations %s were used\n", filterDescription);
+    }
+    if (!interleavedSearch) {
+        //perfect matchings are not enumerated separately in the interleaved search
+        fprintf(stderr, "\nMatchings: %llu\n", totalPerfectMatchingsCount);
     }
-    fprintf(stderr, "\nMatchings: %llu\n", totalPerfectMatchingsCount);
     fprintf(stderr, "\nAssignments: %llu\n", assignmentCount);
     fprintf(stderr, "\nSolvable: %llu\n", solvable);
     fprintf(stderr, "\nSolvable and canonical: %llu\n", solvableAndCanonical);
@@ -1753,8 +3334,76 @@ void printSummary() {
         fprintf(stderr, "\n%llu quadrangulations do not correspond to a tiling.\n", unusedGraphCount);
         fprintf(stderr, "%llu quadrangulations can correspond to a tiling.\n", numberOfQuadrangulations - unusedGraphCount);
         fprintf(stderr, "\nRejected by coefficient diff: %llu\n", rejectedByCoefficientDiff);
-        fprintf(stderr, "Rejected by lpsolve: %llu\n\n", assignmentCount - solvable - rejectedByCoefficientDiff);
+        fprintf(stderr, "Rejected by exact solver: %llu\n\n", assignmentCount - solvable - rejectedByCoefficientDiff);
+        if (useFeasibilityCache) {
+            fprintf(stderr, "Feasibility cache hits: %llu\n", feasibilityCacheHits);
+            fprintf(stderr, "Feasibility cache misses: %llu\n\n", feasibilityCacheMisses);
+            if (persistentCacheFileName != NULL) {
+                fprintf(stderr, "Persistent cache hits: %llu\n", persistentCacheHits);
+                fprintf(stderr, "Persistent cache records loaded: %llu\n", persistentCacheRecordsLoaded);
+                fprintf(stderr, "Persistent cache records written: %llu\n\n", persistentCacheRecordsWritten);
+            }
+        }
+    }
+}
+
+void updateInputVertexCount(int vertexCount) {
+    if (numberOfQuadrangulations == 1) {
+        inputVertexCount = vertexCount;
+    } else if (inputVertexCount != vertexCount) {
+        inputVertexCount = -1;
+    }
+}
+
+/* Writes all counters to the summary file as a JSON object with one member
+ * per line. The summaries of the parts of a run split with --res and --mod
+ * can be combined with tools/stcq_merge.
+ */
+void writeSummaryFile() {
+    unsigned long long int totalPerfectMatchingsCount = 0;
+    item *currentItem;
+    FILE *f = fopen(summaryFileName, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open summary file %s -- exiting!\n", summaryFileName);
+        exit(1);
+    }
+    for (currentItem = perfect_matchings_counts; currentItem != NULL; currentItem = currentItem->next) {
+        totalPerfectMatchingsCount += (currentItem->value) * (currentItem->key);
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"format\": \"stcq_summary\",\n");
+    fprintf(f, "  \"version\": 2,\n");
+    fprintf(f, "  \"vertices\": %d,\n", inputVertexCount);
+    fprintf(f, "  \"concave\": %s,\n", onlyConvex ? "false" : "true");
+    fprintf(f, "  \"stcq4\": %s,\n", generateSTCQ4 ? "true" : "false");
+    fprintf(f, "  \"mirror\": %s,\n", mirrorImagesAreDistinct ? "true" : "false");
+    fprintf(f, "  \"interleaved\": %s,\n", interleavedSearch ? "true" : "false");
+    fprintf(f, "  \"symmetry_breaking\": %s,\n", breakSymmetry ? "true" : "false");
+    fprintf(f, "  \"filter\": \"%s\",\n", filterRangeCount > 0 ? filterDescription : "");
+    fprintf(f, "  \"res\": %llu,\n", partitionResidue);
+    fprintf(f, "  \"mod\": %llu,\n", partitionModulus);
+    fprintf(f, "  \"blocks\": %s,\n", isBlockPartition ? "true" : "false");
+    fprintf(f, "  \"split_depth\": %d,\n", splitDepth);
+    fprintf(f, "  \"quadrangulations\": %llu,\n", numberOfQuadrangulations);
+    fprintf(f, "  \"unused_quadrangulations\": %llu,\n", unusedGraphCount);
+    fprintf(f, "  \"matchings\": %llu,\n", totalPerfectMatchingsCount);
+    fprintf(f, "  \"assignments\": %llu,\n", assignmentCount);
+    fprintf(f, "  \"solvable\": %llu,\n", solvable);
+    fprintf(f, "  \"solvable_and_canonical\": %llu,\n", solvableAndCanonical);
+    fprintf(f, "  \"rejected_by_coefficient_diff\": %llu,\n", rejectedByCoefficientDiff);
+    fprintf(f, "  \"feasibility_cache_hits\": %llu,\n", feasibilityCacheHits);
+    fprintf(f, "  \"feasibility_cache_misses\": %llu,\n", feasibilityCacheMisses);
+    fprintf(f, "  \"persistent_cache_hits\": %llu,\n", persistentCacheHits);
+    fprintf(f, "  \"persistent_cache_records_loaded\": %llu,\n", persistentCacheRecordsLoaded);
+    fprintf(f, "  \"persistent_cache_records_written\": %llu,\n", persistentCacheRecordsWritten);
+    fprintf(f, "  \"perfect_matchings\": [");
+    for (currentItem = perfect_matchings_counts; currentItem != NULL; currentItem = currentItem->next) {
+        fprintf(f, "[%d, %d]%s", currentItem->key, currentItem->value,
+                currentItem->next == NULL ? "" : ", ");
     }
+    fprintf(f, "]\n");
+    fprintf(f, "}\n");
+    fclose(f);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1792,7 +3441,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1812,7 +3460,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1835,7 +3482,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1855,7 +3501,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1887,7 +3532,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1907,7 +3551,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1927,7 +3570,6 @@ void orderFaces(){
                     numberedFacesAt[edge->start]++;
                     if(numberedFacesAt[edge->start]==degree[edge->start]){
                         //vertex completed
-                        checkVerticesAfterFace[faceCounter] = TRUE;
                         vertexCompletedAfterFace[edge->start] = faceCounter;
                     }
                     edge = edge->inverse->prev;
@@ -1959,8 +3601,7 @@ void orderFaces(){
                         numberedFacesAt[edge->start]++;
                         if(numberedFacesAt[edge->start]==degree[edge->start]){
                             //vertex completed
-                            checkVerticesAfterFace[faceCounter] = TRUE;
-                            vertexCompletedAfterFace[edge->start] = faceCounter;
+                        vertexCompletedAfterFace[edge->start] = faceCounter;
                         }
                         edge = edge->inverse->prev;
                     } while (edge!=edgelast);
@@ -1977,6 +3618,24 @@ void orderFaces(){
     for(i = 0; i < nf; i++){
         faceRank[orderedFaces[i]] = i;
     }
+    
+    //sort the vertices by the face that completes them
+    for(i = 0; i <= nf; i++){
+        completedVerticesStart[i] = 0;
+    }
+    for(i = 0; i < nv; i++){
+        completedVerticesStart[vertexCompletedAfterFace[i] + 1]++;
+    }
+    for(i = 0; i < nf; i++){
+        completedVerticesStart[i + 1] += completedVerticesStart[i];
+    }
+    for(i = 0; i < nv; i++){
+        completedVertices[completedVerticesStart[vertexCompletedAfterFace[i]]++] = i;
+    }
+    for(i = nf; i > 0; i--){
+        completedVerticesStart[i] = completedVerticesStart[i - 1];
+    }
+    completedVerticesStart[0] = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -2071,46 +3730,30 @@ void relabelQuadrangulation(){
     }
 }
 
-EDGE *findEdge(int from, int to){
-    EDGE *e, *elast;
-    
-    e = elast = firstedge[from];
-    do {
-        if(e->end==to){
-            return e;
-        }
-        e = e->next;
-    } while (e!=elast);
-    fprintf(stderr, "error while looking for edge from %d to %d.\n", from, to);
-    exit(0);
-}
-
  
 /* Store in the rightface field of each edge the number of the face on
    the right hand side of that edge.  Faces are numbered 0,1,....  Also
    store in facestart[i] an example of an edge in the clockwise orientation
    of the face boundary, and the size of the face in facesize[i], for each i.
-   Returns the number of faces. */
+   The rightface of each edge has to be -1 when this is called: it marks the
+   edges of which the face isn't known yet. */
 void makeDual(){
     register int i,sz;
     register EDGE *e,*ex,*ef,*efx;
  
-    RESETMARKS;
- 
     nf = 0;
     for (i = 0; i < nv; ++i){
 
         e = ex = firstedge[i];
         do
         {
-            if (!ISMARKEDLO(e))
+            if (e->rightface < 0)
             {
                 facestart[nf] = ef = efx = e;
                 sz = 0;
                 do
                 {
                     ef->rightface = nf;
-                    MARKLO(ef);
                     ef = ef->inverse->prev;
                     ++sz;
                 } while (ef != efx);
@@ -2123,180 +3766,1763 @@ void makeDual(){
 }
 
 
+/* Decodes the planar code in time linear in its length. The edges from a
+ * vertex to a vertex with a larger number are put in a list for the larger
+ * vertex, linked by their inverse field. Before a vertex is decoded, the edges
+ * in its list are stored in edgeFromNeighbour by their start, so the inverse
+ * of each edge to a smaller vertex is found at once. Input that is not a
+ * valid embedding is rejected. */
 void decodePlanarCode(unsigned short* code) {
-    /* complexity of method to determine inverse isn't that good, but will have to satisfy for now
-     */
-    int i, j, codePosition;
-    int edgeCounter = 0;
-    EDGE *inverse;
+    int i, j, neighbour, codePosition;
+    int edgeCounter = 0, inverseCount = 0;
+    EDGE *e, *inverse;
+    EDGE *edgesFromSmallerVertices[MAXN];
+    EDGE *edgeFromNeighbour[MAXN];
 
     nv = code[0];
     codePosition = 1;
 
     for (i = 0; i < nv; i++) {
-        degree[i] = 0;
+        edgesFromSmallerVertices[i] = edgeFromNeighbour[i] = NULL;
+    }
+
+    for (i = 0; i < nv; i++) {
+        for (e = edgesFromSmallerVertices[i]; e != NULL; e = e->inverse) {
+            edgeFromNeighbour[e->start] = e;
+        }
         firstedge[i] = edges + edgeCounter;
-        edges[edgeCounter].start = i;
-        edges[edgeCounter].end = code[codePosition] - 1;
-        edges[edgeCounter].next = edges + edgeCounter + 1;
-        edges[edgeCounter].allowedInFaceMatching = TRUE;
-        if(code[codePosition] - 1 < i){
-            inverse = findEdge(code[codePosition]-1, i);
-            edges[edgeCounter].inverse = inverse;
-            inverse->inverse = edges + edgeCounter;
-        } else {
-            edges[edgeCounter].inverse = NULL;
+        for (j = 0; code[codePosition]; j++, codePosition++) {
+            if (j == MAXVAL) {
+                fprintf(stderr, "MAXVAL too small: %d\n", MAXVAL);
+                exit(0);
+            }
+            neighbour = code[codePosition] - 1;
+            if (neighbour >= nv || neighbour == i) {
+                fprintf(stderr, "Invalid planar code: vertex %d has neighbour %d -- exiting!\n", i + 1, neighbour + 1);
+                exit(1);
+            }
+            e = edges + edgeCounter;
+            e->start = i;
+            e->end = neighbour;
+            e->prev = e - 1;
+            e->next = e + 1;
+            e->allowedInFaceMatching = TRUE;
+            e->rightface = -1;
+            if (neighbour < i) {
+                inverse = edgeFromNeighbour[neighbour];
+                //an edge that is left from an earlier vertex doesn't end in i
+                if (inverse == NULL || inverse->end != i) {
+                    fprintf(stderr, "Invalid planar code: no edge from %d to %d -- exiting!\n", neighbour + 1, i + 1);
+                    exit(1);
+                }
+                edgeFromNeighbour[neighbour] = NULL;
+                e->inverse = inverse;
+                inverse->inverse = e;
+                inverseCount++;
+            } else {
+                e->inverse = edgesFromSmallerVertices[neighbour];
+                edgesFromSmallerVertices[neighbour] = e;
+            }
+            edgeCounter++;
+        }
+        if (j == 0) {
+            fprintf(stderr, "Invalid planar code: vertex %d has no neighbours -- exiting!\n", i + 1);
+            exit(1);
+        }
+        firstedge[i]->prev = edges + edgeCounter - 1;
+        edges[edgeCounter-1].next = firstedge[i];
+        degree[i] = j;
+        
+        codePosition++; /* read the closing 0 */
+    }
+    
+    ne = edgeCounter;
+    
+    if (2*inverseCount != ne) {
+        fprintf(stderr, "Invalid planar code: not every edge has an inverse edge -- exiting!\n");
+        exit(1);
+    }
+    
+    makeDual();
+    
+    if (nv - ne/2 + nf != 2) {
+        fprintf(stderr, "Invalid planar code: the embedding is not planar -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* Builds the current quadrangulation from its edges. The edges of vertex i
+ * are numbered consecutively in clockwise order, starting after those of
+ * vertex i-1: ends contains the end of each edge and inverses the number of
+ * its inverse edge. Unlike decodePlanarCode() no edges have to be searched.
+ */
+void loadEmbedding(int vertexCount, int *degrees, int *ends, int *inverses){
+    int i, j;
+    int edgeCounter = 0;
+    
+    nv = vertexCount;
+    for (i = 0; i < nv; i++) {
+        if (degrees[i] > MAXVAL) {
+            fprintf(stderr, "MAXVAL too small: %d\n", MAXVAL);
+            exit(0);
+        }
+        degree[i] = degrees[i];
+        firstedge[i] = edges + edgeCounter;
+        for (j = 0; j < degrees[i]; j++, edgeCounter++) {
+            edges[edgeCounter].start = i;
+            edges[edgeCounter].end = ends[edgeCounter];
+            edges[edgeCounter].next = (j + 1 < degrees[i]) ? edges + edgeCounter + 1 : firstedge[i];
+            edges[edgeCounter].prev = (j > 0) ? edges + edgeCounter - 1 : firstedge[i] + degrees[i] - 1;
+            edges[edgeCounter].inverse = edges + inverses[edgeCounter];
+            edges[edgeCounter].allowedInFaceMatching = TRUE;
+            edges[edgeCounter].rightface = -1;
+        }
+    }
+    
+    ne = edgeCounter;
+    
+    makeDual();
+}
+
+/* The input is read in large blocks instead of byte by byte: a regular file
+ * is mapped in memory as a whole, other input is read in blocks of
+ * INPUT_BLOCK_SIZE bytes. The first byte of inputData is at position
+ * inputOffset in the file, and inputIndex is the next byte to be parsed.
+ */
+#define INPUT_BLOCK_SIZE (4*1024*1024)
+
+FILE *inputFile = NULL;
+unsigned char *inputData = NULL;
+size_t inputDataLength = 0;
+size_t inputIndex = 0;
+long inputOffset = 0;
+boolean isInputMapped = FALSE;
+
+void openInput(FILE *file){
+    struct stat fileStatus;
+    
+    inputFile = file;
+    inputOffset = ftell(file);
+    if(inputOffset < 0){
+        inputOffset = 0;
+    }
+    if(fstat(fileno(file), &fileStatus) == 0 && S_ISREG(fileStatus.st_mode) &&
+            fileStatus.st_size > inputOffset){
+        void *data = mmap(NULL, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if(data != MAP_FAILED){
+            madvise(data, fileStatus.st_size, MADV_SEQUENTIAL);
+            inputData = data;
+            inputDataLength = fileStatus.st_size;
+            inputIndex = inputOffset;
+            inputOffset = 0;
+            isInputMapped = TRUE;
+            return;
+        }
+    }
+    inputData = (unsigned char *)malloc(INPUT_BLOCK_SIZE);
+    if(inputData == NULL){
+        fprintf(stderr, "Insufficient memory for the input -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* Reads the next block of the input after the bytes that are not parsed yet.
+ * Returns FALSE at the end of the input.
+ */
+boolean readInputBlock(){
+    size_t remaining = inputDataLength - inputIndex;
+    ssize_t size;
+    
+    if(isInputMapped){
+        return FALSE;
+    }
+    memmove(inputData, inputData + inputIndex, remaining);
+    inputOffset += inputIndex;
+    inputIndex = 0;
+    inputDataLength = remaining;
+    do {
+        //read() returns what is available, so input from a pipe is handled at once
+        size = read(fileno(inputFile), inputData + remaining, INPUT_BLOCK_SIZE - remaining);
+    } while(size < 0 && errno == EINTR);
+    if(size < 0){
+        fprintf(stderr, "Error while reading the input -- exiting!\n");
+        exit(1);
+    }
+    inputDataLength += size;
+    return size > 0;
+}
+
+/* Returns TRUE if the next count bytes of the input are in inputData.
+ */
+boolean isInputAvailable(size_t count){
+    while(inputDataLength - inputIndex < count){
+        if(!readInputBlock()){
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int readInputByte(){
+    if(inputIndex == inputDataLength && !readInputBlock()){
+        return EOF;
+    }
+    return inputData[inputIndex++];
+}
+
+/* Reads an unsigned short in the byte order of this machine.
+ */
+boolean readInputShort(unsigned short *value){
+    if(!isInputAvailable(sizeof(unsigned short))){
+        return FALSE;
+    }
+    memcpy(value, inputData + inputIndex, sizeof(unsigned short));
+    inputIndex += sizeof(unsigned short);
+    return TRUE;
+}
+
+/* Returns the position in the input of the next quadrangulation, or -1 if
+ * the input is not a file.
+ */
+long getInputPosition(){
+    if(inputFile == NULL || (!isInputMapped && lseek(fileno(inputFile), 0, SEEK_CUR) < 0)){
+        return -1;
+    }
+    return inputOffset + inputIndex;
+}
+
+/* The state of the input after a quadrangulation, from which a checkpoint can
+ * continue the input.
+ */
+typedef struct {
+    unsigned long long int number; //the number of quadrangulations that were read
+    long position; //see getInputPosition()
+    int vertexCount; //see updateInputVertexCount()
+} INPUT_STATE;
+
+void getInputState(INPUT_STATE *state){
+    state->number = numberOfQuadrangulations;
+    state->position = getInputPosition();
+    state->vertexCount = inputVertexCount;
+}
+
+/* Continues reading the input at the given position. Returns FALSE if this
+ * is not possible.
+ */
+boolean seekInput(long position){
+    if(isInputMapped){
+        if(position > inputDataLength){
+            return FALSE;
+        }
+        inputIndex = position;
+        return TRUE;
+    }
+    if(lseek(fileno(inputFile), position, SEEK_SET) < 0){
+        return FALSE;
+    }
+    inputOffset = position;
+    inputDataLength = inputIndex = 0;
+    return TRUE;
+}
+
+void readPlanarCodeHeader() {
+    int c;
+    char testheader[20];
+    int i;
+
+    for (i = 0; i < 15 && (c = readInputByte()) != EOF; i++) {
+        testheader[i] = c;
+    }
+    if (i != 15) {
+        fprintf(stderr, "can't read header ((1)file too small)-- exiting\n");
+        exit(1);
+    }
+    testheader[15] = 0;
+    if (strcmp(testheader, ">>planar_code<<") == 0) {
+        
+    } else {
+        fprintf(stderr, "No planarcode header detected -- exiting!\n");
+        exit(1);
+    }
+}
+
+/**
+ * 
+ * @param code
+ * @param laenge
+ * @param file
+ * @return returns 1 if a code was read and 0 otherwise. Exits in case of error.
+ */
+int readPlanarCode(unsigned short code[], int *length, FILE *file) {
+    int c;
+    int bufferSize, zeroCounter;
+
+
+    if (inputFile == NULL) {
+        openInput(file);
+        readPlanarCodeHeader();
+    }
+
+    /* possibly removing interior headers -- only done for planarcode */
+    if ((c = readInputByte()) == EOF){
+        //nothing left in file
+        return (0);
+    }
+    
+    if (c == '>' && isInputAvailable(2) &&
+            inputData[inputIndex] == '>' && inputData[inputIndex + 1] == 'p'){
+        // could be a header, or maybe just a 62 (which is also possible for unsigned char
+        /*we are sure that we're dealing with a header*/
+        while ((c = readInputByte()) != '<' && c != EOF);
+        /* read 2 more characters: */
+        c = readInputByte();
+        if (c != '<') {
+            fprintf(stderr, "Problems with header -- single '<'\n");
+            exit(1);
+        }
+        if ((c = readInputByte()) == EOF){
+            //nothing left in file
+            return (0);
+        }
+    }
+    bufferSize = 1;
+    zeroCounter = 0;
+
+    if (c != 0) /* unsigned chars would be sufficient */ {
+        code[0] = c;
+        if (code[0] > MAXN) {
+            fprintf(stderr, "Constant N too small %d > %d \n", code[0], MAXN);
+            exit(1);
+        }
+        while (zeroCounter < code[0]) {
+            if ((c = readInputByte()) == EOF) {
+                fprintf(stderr, "Unexpected EOF.\n");
+                exit(1);
+            }
+            code[bufferSize] = c;
+            if (code[bufferSize] == 0) zeroCounter++;
+            bufferSize++;
+        }
+    } else {
+        if(!readInputShort(code)){
+            fprintf(stderr, "Unexpected EOF.\n");
+            exit(1);
+        }
+        if (code[0] > MAXN) {
+            fprintf(stderr, "Constant N too small %d > %d \n", code[0], MAXN);
+            exit(1);
+        }
+        while (zeroCounter < code[0]) {
+            if(!readInputShort(code + bufferSize)){
+                fprintf(stderr, "Unexpected EOF.\n");
+                exit(1);
+            }
+            if (code[bufferSize] == 0) zeroCounter++;
+            bufferSize++;
+        }
+    }
+
+    *length = bufferSize;
+    return (1);
+
+
+}
+
+/* Offset index of a planar code file. The index consists of a header followed
+ * by the position and the number of vertices of each quadrangulation in the
+ * file, so the quadrangulations that are handled (see -f, --res and --blocks)
+ * can be read directly instead of decoding all the others. If the index file
+ * doesn't exist, it is built in one pass over the input.
+ */
+
+#define OFFSET_INDEX_MAGIC 0x58444e49u //"INDX"
+#define OFFSET_INDEX_VERSION 1
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long int inputSize; //size of the input file that was indexed
+    unsigned long long int count; //number of quadrangulations in the input
+    int vertexCount; //number of vertices of all quadrangulations, or -1
+    int padding;
+} OFFSET_INDEX_HEADER;
+
+typedef struct {
+    unsigned long long int offset;
+    int vertexCount;
+    int padding;
+} OFFSET_INDEX_ENTRY;
+
+char *offsetIndexFileName = NULL;
+OFFSET_INDEX_HEADER *offsetIndex = NULL;
+OFFSET_INDEX_ENTRY *offsetIndexEntries = NULL;
+
+unsigned long long int getOffsetIndexCount(){
+    return offsetIndex == NULL ? 0 : offsetIndex->count;
+}
+
+void buildOffsetIndex(unsigned long long int inputSize){
+    char temporaryFileName[strlen(offsetIndexFileName) + 5];
+    unsigned short code[MAXCODELENGTH];
+    int length;
+    OFFSET_INDEX_HEADER header = {OFFSET_INDEX_MAGIC, OFFSET_INDEX_VERSION, inputSize, 0, 0, 0};
+    OFFSET_INDEX_ENTRY entry = {0, 0, 0};
+    long start = getInputPosition();
+    
+    sprintf(temporaryFileName, "%s.tmp", offsetIndexFileName);
+    FILE *f = fopen(temporaryFileName, "w");
+    if(f == NULL){
+        fprintf(stderr, "Could not write offset index %s -- exiting!\n", temporaryFileName);
+        exit(1);
+    }
+    fwrite(&header, sizeof(OFFSET_INDEX_HEADER), 1, f);
+    entry.offset = start;
+    while(readPlanarCode(code, &length, inputFile)){
+        entry.vertexCount = code[0];
+        if(header.count == 0){
+            header.vertexCount = code[0];
+        } else if(header.vertexCount != code[0]){
+            header.vertexCount = -1;
+        }
+        fwrite(&entry, sizeof(OFFSET_INDEX_ENTRY), 1, f);
+        header.count++;
+        entry.offset = getInputPosition();
+    }
+    rewind(f);
+    fwrite(&header, sizeof(OFFSET_INDEX_HEADER), 1, f);
+    boolean failed = ferror(f);
+    //the index is only visible under its name when it is complete
+    if(fclose(f) || failed || rename(temporaryFileName, offsetIndexFileName)){
+        fprintf(stderr, "Could not write offset index %s -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    seekInput(start);
+}
+
+void openOffsetIndex(FILE *file){
+    struct stat inputStatus, indexStatus;
+    
+    openInput(file);
+    readPlanarCodeHeader();
+    if(getInputPosition() < 0 || fstat(fileno(file), &inputStatus) != 0 || !S_ISREG(inputStatus.st_mode)){
+        fprintf(stderr, "--index requires the input to be a file -- exiting!\n");
+        exit(1);
+    }
+    
+    int fd = open(offsetIndexFileName, O_RDONLY);
+    if(fd < 0 && errno == ENOENT){
+        buildOffsetIndex(inputStatus.st_size);
+        fd = open(offsetIndexFileName, O_RDONLY);
+    }
+    if(fd < 0){
+        fprintf(stderr, "Could not open offset index %s -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    if(fstat(fd, &indexStatus) != 0){
+        fprintf(stderr, "Could not stat offset index %s -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    if(indexStatus.st_size < sizeof(OFFSET_INDEX_HEADER)){
+        fprintf(stderr, "File %s is not a compatible offset index -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    offsetIndex = mmap(NULL, indexStatus.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(offsetIndex == MAP_FAILED){
+        fprintf(stderr, "Could not map offset index %s -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    close(fd);
+    
+    if(offsetIndex->magic != OFFSET_INDEX_MAGIC || offsetIndex->version != OFFSET_INDEX_VERSION ||
+            indexStatus.st_size != sizeof(OFFSET_INDEX_HEADER) + offsetIndex->count * sizeof(OFFSET_INDEX_ENTRY)){
+        fprintf(stderr, "File %s is not a compatible offset index -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    if(offsetIndex->inputSize != inputStatus.st_size){
+        fprintf(stderr, "The offset index %s doesn't belong to the input -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    offsetIndexEntries = (OFFSET_INDEX_ENTRY *)(offsetIndex + 1);
+}
+
+/* Reads the next quadrangulation and sets numberOfQuadrangulations to its
+ * number. With an offset index this is the next quadrangulation that is
+ * handled, and the quadrangulations before it are skipped.
+ */
+boolean readNextQuadrangulation(unsigned short code[], int *length, FILE *file){
+    if(offsetIndex == NULL){
+        if(!readPlanarCode(code, length, file)){
+            return FALSE;
+        }
+        numberOfQuadrangulations++;
+        updateInputVertexCount(code[0]);
+        return TRUE;
+    }
+    
+    unsigned long long int next = findNextHandledQuadrangulation(numberOfQuadrangulations + 1, offsetIndex->count);
+    inputVertexCount = offsetIndex->vertexCount;
+    if(next == 0){
+        numberOfQuadrangulations = offsetIndex->count;
+        return FALSE;
+    }
+    long offset = offsetIndexEntries[next - 1].offset;
+    //consecutive quadrangulations are read without seeking
+    if((offset != inputOffset + inputIndex && !seekInput(offset)) || !readPlanarCode(code, length, file) ||
+            code[0] != offsetIndexEntries[next - 1].vertexCount){
+        fprintf(stderr, "The offset index %s doesn't belong to the input -- exiting!\n", offsetIndexFileName);
+        exit(1);
+    }
+    numberOfQuadrangulations = next;
+    return TRUE;
+}
+
+//====================== USAGE =======================
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* Handles the current quadrangulation after it was decoded.
+ */
+void handleDecodedQuadrangulation(unsigned long long int number){
+    if(relabelInputQuadrangulation){
+        relabelQuadrangulation();
+    }
+    if(!isEarlyFilteringEnabled || earlyFilterQuadrangulations()){
+        orderFaces();
+        calculateAutomorphismGroupQuadrangulation();
+        if(startPartitionedSearch(number)){
+            generate_perfect_matchings_in_dual(); 
+            partitionSearch = FALSE;
+        }
+    } else if(unusedQuadrangulations){
+        unusedGraphCount++;
+        outputQuadrangulation();
+    } else {
+        unusedGraphCount++;
+    }
+}
+
+void handleQuadrangulation(unsigned short *code, unsigned long long int number){
+    decodePlanarCode(code);
+    handleDecodedQuadrangulation(number);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* The counters of a thread can be moved to a COUNTERS structure, so that the
+ * counters of each quadrangulation can be added in the order of the input.
+ */
+
+typedef struct {
+    unsigned long long int unusedGraphCount;
+    unsigned long long int solvable;
+    unsigned long long int solvableAndCanonical;
+    unsigned long long int assignmentCount;
+    unsigned long long int rejectedByCoefficientDiff;
+    unsigned long long int feasibilityCacheHits;
+    unsigned long long int feasibilityCacheMisses;
+    unsigned long long int persistentCacheHits;
+    unsigned long long int persistentCacheRecordsLoaded;
+    unsigned long long int persistentCacheRecordsWritten;
+    item *perfectMatchingsCounts;
+} COUNTERS;
+
+void addCounters(COUNTERS *to, COUNTERS *from){
+    item *currentItem;
+    to->unusedGraphCount += from->unusedGraphCount;
+    to->solvable += from->solvable;
+    to->solvableAndCanonical += from->solvableAndCanonical;
+    to->assignmentCount += from->assignmentCount;
+    to->rejectedByCoefficientDiff += from->rejectedByCoefficientDiff;
+    to->feasibilityCacheHits += from->feasibilityCacheHits;
+    to->feasibilityCacheMisses += from->feasibilityCacheMisses;
+    to->persistentCacheHits += from->persistentCacheHits;
+    to->persistentCacheRecordsLoaded += from->persistentCacheRecordsLoaded;
+    to->persistentCacheRecordsWritten += from->persistentCacheRecordsWritten;
+    for(currentItem = from->perfectMatchingsCounts; currentItem != NULL; currentItem = currentItem->next){
+        to->perfectMatchingsCounts = incrementBy(to->perfectMatchingsCounts, currentItem->key, currentItem->value);
+    }
+}
+
+void freeCounters(COUNTERS *counters){
+    freeList(counters->perfectMatchingsCounts);
+    memset(counters, 0, sizeof(COUNTERS));
+}
+
+/* Copies the counters of the calling thread. The list of the numbers of
+ * perfect matchings is shared.
+ */
+void getCounters(COUNTERS *counters){
+    counters->unusedGraphCount = unusedGraphCount;
+    counters->solvable = solvable;
+    counters->solvableAndCanonical = solvableAndCanonical;
+    counters->assignmentCount = assignmentCount;
+    counters->rejectedByCoefficientDiff = rejectedByCoefficientDiff;
+    counters->feasibilityCacheHits = feasibilityCacheHits;
+    counters->feasibilityCacheMisses = feasibilityCacheMisses;
+    counters->persistentCacheHits = persistentCacheHits;
+    counters->persistentCacheRecordsLoaded = persistentCacheRecordsLoaded;
+    counters->persistentCacheRecordsWritten = persistentCacheRecordsWritten;
+    counters->perfectMatchingsCounts = perfect_matchings_counts;
+}
+
+/* Sets the counters of the calling thread. The list of the numbers of perfect
+ * matchings is shared.
+ */
+void setCounters(COUNTERS *counters){
+    unusedGraphCount = counters->unusedGraphCount;
+    solvable = counters->solvable;
+    solvableAndCanonical = counters->solvableAndCanonical;
+    assignmentCount = counters->assignmentCount;
+    rejectedByCoefficientDiff = counters->rejectedByCoefficientDiff;
+    feasibilityCacheHits = counters->feasibilityCacheHits;
+    feasibilityCacheMisses = counters->feasibilityCacheMisses;
+    persistentCacheHits = counters->persistentCacheHits;
+    persistentCacheRecordsLoaded = counters->persistentCacheRecordsLoaded;
+    persistentCacheRecordsWritten = counters->persistentCacheRecordsWritten;
+    perfect_matchings_counts = counters->perfectMatchingsCounts;
+}
+
+/* Adds the counters of the calling thread to the given counters, and resets
+ * them.
+ */
+void moveCounters(COUNTERS *to){
+    COUNTERS counters;
+    getCounters(&counters);
+    addCounters(to, &counters);
+    freeCounters(&counters);
+    setCounters(&counters);
+}
+
+//the counters of the quadrangulations that were written in the order of the
+//input, and the counters of the run before (from a checkpoint)
+COUNTERS writtenCounters;
+
+void takeCheckpointIfDue(INPUT_STATE *input, COUNTERS *counters);
+
+/* Adds the counters of a quadrangulation of which the output was written. A
+ * checkpoint is taken between two quadrangulations.
+ */
+void countWrittenQuadrangulation(INPUT_STATE *input, COUNTERS *counters){
+    addCounters(&writtenCounters, counters);
+    takeCheckpointIfDue(input, &writtenCounters);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* With -j the main thread reads the quadrangulations and puts them at the
+ * back of a deque, from which the worker threads take them. Each worker has its
+ * own copy of the thread-local state. After each task it moves its counters to
+ * the quadrangulation, and they are added to writtenCounters when the output of
+ * the quadrangulation is written, so there is a consistent state for a
+ * checkpoint after each quadrangulation.
+ * 
+ * With --splitdepth the search of a quadrangulation is split at the given
+ * depth: the subtrees are put at the front of the deque as subtasks, so that
+ * idle workers take them before they start a new quadrangulation. A subtask
+ * consists of the prefix of the search that leads to the subtree: the matching
+ * edges chosen by matchNextFace(), or the matching edges and directions of the
+ * faces decided in the interleaved search. When the deque is full, the subtree
+ * is handled by the thread that found it. The reader only uses half of the
+ * deque, so there is always room for subtasks after a while.
+ * 
+ * The output of each task goes to its own output chunk: the root task has
+ * index -1, the subtrees at the split depth are numbered in the order of the
+ * search, and the output of finishQuadrangulation() comes last. When all tasks
+ * of a quadrangulation are done, the quadrangulation is put in the reorder
+ * buffer, which writes the chunks in the order of the input, so the output is
+ * the same as with a single thread. The waiting chunks are moved to the spill
+ * file when they use more than REORDER_BUFFER_LIMIT bytes of memory. The
+ * reader waits when more than REORDER_BUFFER_GRAPH_LIMIT quadrangulations or
+ * REORDER_BUFFER_SIZE_LIMIT bytes of output are waiting for an earlier
+ * quadrangulation.
+ */
+
+#define JOB_QUEUE_SIZE 1024
+#define WORKER_STACK_SIZE (16*1024*1024)
+#define REORDER_BUFFER_LIMIT (64*1024*1024)
+#define REORDER_BUFFER_GRAPH_LIMIT (4*JOB_QUEUE_SIZE)
+#define REORDER_BUFFER_SIZE_LIMIT (1024ULL*1024*1024)
+
+typedef struct graph_job {
+    unsigned short code[MAXCODELENGTH];
+    INPUT_STATE input; //the number is input.number
+    unsigned long long int sequence; //the position among the queued quadrangulations
+    int pendingTasks; //the root task and the subtasks that are not finished
+    int matchingCount;
+    unsigned long long int solvable;
+    int subtreeCount; //the subtrees at the split depth so far
+    COUNTERS counters; //the counters of the tasks that are finished
+    OUTPUT_CHUNK *outputChunks; //sorted by index
+    struct graph_job *nextInReorderBuffer;
+} GRAPH_JOB;
+
+typedef struct {
+    GRAPH_JOB *graph;
+    int prefixLength; //0 for the root task of the quadrangulation
+    int subtreeIndex;
+    int prefixEdges[MAXF]; //indices in edges
+    int prefixDirections[MAXF];
+} JOB;
+
+JOB jobQueue[JOB_QUEUE_SIZE];
+int jobQueueHead = 0; //position of the next job to take
+int jobQueueSize = 0;
+boolean jobQueueClosed = FALSE;
+pthread_mutex_t jobQueueLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobQueueNotEmpty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobQueueNotFull = PTHREAD_COND_INITIALIZER;
+
+THREAD_LOCAL GRAPH_JOB *currentGraphJob;
+
+unsigned long long int queuedGraphCount = 0;
+
+//the quadrangulations that are done, sorted by sequence
+GRAPH_JOB *reorderBuffer = NULL;
+unsigned long long int nextOutputSequence = 0;
+size_t reorderBufferMemory = 0;
+unsigned long long int reorderBufferSize = 0; //including the output in the spill file
+int reorderBufferGraphCount = 0;
+pthread_mutex_t reorderBufferLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reorderBufferWritten = PTHREAD_COND_INITIALIZER;
+
+//called when the output of a quadrangulation was written (used by --procs)
+void (*graphOutputWritten)(INPUT_STATE *input, COUNTERS *counters) = NULL;
+
+//the counters of all workers that are done
+pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+COUNTERS totalCounters;
+
+void addJob(unsigned short *code, int length, INPUT_STATE *input){
+    GRAPH_JOB *graph = (GRAPH_JOB *) malloc(sizeof (GRAPH_JOB));
+    if(graph == NULL){
+        fprintf(stderr, "Insufficient memory for job -- exiting!\n");
+        exit(1);
+    }
+    memcpy(graph->code, code, sizeof(unsigned short)*length);
+    graph->input = *input;
+    graph->sequence = queuedGraphCount++;
+    graph->pendingTasks = 1;
+    graph->matchingCount = 0;
+    graph->solvable = 0;
+    graph->subtreeCount = 0;
+    memset(&(graph->counters), 0, sizeof(COUNTERS));
+    graph->outputChunks = NULL;
+    
+    //the earliest quadrangulation that is not written is already queued
+    pthread_mutex_lock(&reorderBufferLock);
+    while(reorderBufferGraphCount >= REORDER_BUFFER_GRAPH_LIMIT ||
+            reorderBufferSize > REORDER_BUFFER_SIZE_LIMIT){
+        pthread_cond_wait(&reorderBufferWritten, &reorderBufferLock);
+    }
+    pthread_mutex_unlock(&reorderBufferLock);
+    
+    pthread_mutex_lock(&jobQueueLock);
+    while(jobQueueSize >= JOB_QUEUE_SIZE/2){
+        pthread_cond_wait(&jobQueueNotFull, &jobQueueLock);
+    }
+    JOB *job = jobQueue + (jobQueueHead + jobQueueSize) % JOB_QUEUE_SIZE;
+    job->graph = graph;
+    job->prefixLength = 0;
+    jobQueueSize++;
+    pthread_cond_signal(&jobQueueNotEmpty);
+    pthread_mutex_unlock(&jobQueueLock);
+}
+
+/* Makes a new chunk with the given index the current output chunk of the
+ * calling thread.
+ */
+void startOutputChunk(GRAPH_JOB *graph, int index){
+    OUTPUT_CHUNK *chunk = newOutputChunk(index);
+    pthread_mutex_lock(&jobQueueLock);
+    OUTPUT_CHUNK **position = &(graph->outputChunks);
+    while(*position != NULL && (*position)->index < index){
+        position = &((*position)->next);
+    }
+    chunk->next = *position;
+    *position = chunk;
+    pthread_mutex_unlock(&jobQueueLock);
+    currentOutputChunk = chunk;
+}
+
+/* Puts the current subtree of the search at the front of the deque. Returns
+ * FALSE if the deque is full, in which case the caller handles the subtree.
+ */
+boolean spawnSubtask(int prefixLength){
+    int i;
+    int index = currentGraphJob->subtreeCount++;
+    pthread_mutex_lock(&jobQueueLock);
+    if(jobQueueSize == JOB_QUEUE_SIZE){
+        pthread_mutex_unlock(&jobQueueLock);
+        startOutputChunk(currentGraphJob, index);
+        return FALSE;
+    }
+    jobQueueHead = (jobQueueHead + JOB_QUEUE_SIZE - 1) % JOB_QUEUE_SIZE;
+    JOB *job = jobQueue + jobQueueHead;
+    job->graph = currentGraphJob;
+    job->prefixLength = prefixLength;
+    job->subtreeIndex = index;
+    for(i = 0; i < prefixLength; i++){
+        if(interleavedSearch){
+            job->prefixEdges[i] = matchingEdges[decisionOrder[i]] - edges;
+            job->prefixDirections[i] = faceDirection[decisionOrder[i]];
+        } else {
+            job->prefixEdges[i] = matchingEdges[matchingOrder[i]] - edges;
+        }
+    }
+    currentGraphJob->pendingTasks++;
+    jobQueueSize++;
+    pthread_cond_signal(&jobQueueNotEmpty);
+    pthread_mutex_unlock(&jobQueueLock);
+    return TRUE;
+}
+
+void closeJobQueue(){
+    pthread_mutex_lock(&jobQueueLock);
+    jobQueueClosed = TRUE;
+    pthread_cond_broadcast(&jobQueueNotEmpty);
+    pthread_mutex_unlock(&jobQueueLock);
+}
+
+/* Copies the next job to job. Returns FALSE if there are no more jobs.
+ */
+boolean takeJob(JOB *job){
+    pthread_mutex_lock(&jobQueueLock);
+    while(jobQueueSize == 0 && !jobQueueClosed){
+        pthread_cond_wait(&jobQueueNotEmpty, &jobQueueLock);
+    }
+    if(jobQueueSize == 0){
+        pthread_mutex_unlock(&jobQueueLock);
+        return FALSE;
+    }
+    JOB *next = jobQueue + jobQueueHead;
+    job->graph = next->graph;
+    job->prefixLength = next->prefixLength;
+    job->subtreeIndex = next->subtreeIndex;
+    memcpy(job->prefixEdges, next->prefixEdges, sizeof(int)*next->prefixLength);
+    memcpy(job->prefixDirections, next->prefixDirections, sizeof(int)*next->prefixLength);
+    jobQueueHead = (jobQueueHead + 1) % JOB_QUEUE_SIZE;
+    jobQueueSize--;
+    pthread_cond_signal(&jobQueueNotFull);
+    pthread_mutex_unlock(&jobQueueLock);
+    return TRUE;
+}
+
+/* Restores the matching prefix of the subtask and continues matchNextFace().
+ */
+void resumeMatchingSearch(JOB *job){
+    int i;
+    clearMatching();
+    for(i = 0; i < job->prefixLength; i++){
+        EDGE *e = edges + job->prefixEdges[i];
+        int face = e->rightface;
+        int neighbour = e->inverse->rightface;
+        matched[face] = matched[neighbour] = TRUE;
+        match[face] = neighbour;
+        match[neighbour] = face;
+        matchingEdges[face] = e;
+        matchingEdges[neighbour] = e->inverse;
+        matchingOrder[i] = face;
+    }
+    matchNextFace(matchingOrder[job->prefixLength - 1], job->prefixLength);
+}
+
+/* Restores the decided faces of the subtask and continues decideNextFace().
+ */
+void resumeInterleavedSearch(JOB *job){
+    int i;
+    clearInterleavedSearch();
+    for(i = 0; i < job->prefixLength; i++){
+        EDGE *e = edges + job->prefixEdges[i];
+        int face = e->rightface;
+        if(!matched[face]){
+            int neighbour = e->inverse->rightface;
+            matched[face] = matched[neighbour] = TRUE;
+            match[face] = neighbour;
+            match[neighbour] = face;
+            matchingEdges[face] = e;
+            matchingEdges[neighbour] = e->inverse;
+        }
+        faceDecided[face] = TRUE;
+        faceDirection[face] = job->prefixDirections[i];
+        decisionOrder[i] = face;
+        decidedFaceCount++;
+        addAnglesOfFace(face, faceDirection[face]);
+        completeVerticesAtFace(face);
+    }
+    decideNextFace();
+}
+
+/* Puts the quadrangulation in the reorder buffer, and writes the output of all
+ * quadrangulations that are next in the order of the input.
+ */
+void finishGraphOutput(GRAPH_JOB *graph){
+    currentOutputChunk = NULL;
+    //the other tasks of the quadrangulation already moved their counters
+    moveCounters(&(graph->counters));
+    pthread_mutex_lock(&reorderBufferLock);
+    GRAPH_JOB **position = &reorderBuffer;
+    while(*position != NULL && (*position)->sequence < graph->sequence){
+        position = &((*position)->nextInReorderBuffer);
+    }
+    graph->nextInReorderBuffer = *position;
+    *position = graph;
+    
+    OUTPUT_CHUNK *chunk;
+    for(chunk = graph->outputChunks; chunk != NULL; chunk = chunk->next){
+        reorderBufferMemory += getOutputChunkMemory(chunk);
+        reorderBufferSize += getOutputChunkSize(chunk);
+    }
+    reorderBufferGraphCount++;
+    while(reorderBuffer != NULL && reorderBuffer->sequence == nextOutputSequence){
+        GRAPH_JOB *next = reorderBuffer;
+        reorderBuffer = next->nextInReorderBuffer;
+        while(next->outputChunks != NULL){
+            chunk = next->outputChunks;
+            next->outputChunks = chunk->next;
+            reorderBufferMemory -= getOutputChunkMemory(chunk);
+            reorderBufferSize -= getOutputChunkSize(chunk);
+            writeOutputChunk(chunk);
+        }
+        if(graphOutputWritten != NULL){
+            //the parent counts the quadrangulation
+            graphOutputWritten(&(next->input), &(next->counters));
+        } else {
+            countWrittenQuadrangulation(&(next->input), &(next->counters));
+        }
+        freeCounters(&(next->counters));
+        free(next);
+        reorderBufferGraphCount--;
+        nextOutputSequence++;
+        pthread_cond_broadcast(&reorderBufferWritten);
+    }
+    if(reorderBufferMemory > REORDER_BUFFER_LIMIT){
+        GRAPH_JOB *waiting;
+        for(waiting = reorderBuffer; waiting != NULL; waiting = waiting->nextInReorderBuffer){
+            for(chunk = waiting->outputChunks; chunk != NULL; chunk = chunk->next){
+                spillOutputChunk(chunk);
+            }
+        }
+        reorderBufferMemory = 0;
+    }
+    pthread_mutex_unlock(&reorderBufferLock);
+}
+
+/* Adds the results of a task to its quadrangulation. The thread that finishes
+ * the last task of the quadrangulation also finishes the quadrangulation.
+ */
+void finishTask(GRAPH_JOB *graph, int matchings, unsigned long long int solutions){
+    currentOutputChunk = NULL;
+    pthread_mutex_lock(&jobQueueLock);
+    graph->matchingCount += matchings;
+    graph->solvable += solutions;
+    moveCounters(&(graph->counters));
+    int remainingTasks = --graph->pendingTasks;
+    pthread_mutex_unlock(&jobQueueLock);
+    if(remainingTasks == 0){
+        startOutputChunk(graph, INT_MAX);
+        finishQuadrangulation(graph->matchingCount, graph->solvable > 0);
+        finishGraphOutput(graph);
+    }
+}
+
+void handleJob(JOB *job){
+    GRAPH_JOB *graph = job->graph;
+    unsigned long long int oldSolutionCount = solvable;
+    
+    decodePlanarCode(graph->code);
+    if(relabelInputQuadrangulation){
+        relabelQuadrangulation();
+    }
+    startOutputChunk(graph, job->prefixLength == 0 ? -1 : job->subtreeIndex);
+    if(job->prefixLength == 0 && isEarlyFilteringEnabled && !earlyFilterQuadrangulations()){
+        unusedGraphCount++;
+        if(unusedQuadrangulations){
+            outputQuadrangulation();
+        }
+        finishGraphOutput(graph);
+        return;
+    }
+    orderFaces();
+    calculateAutomorphismGroupQuadrangulation();
+    if(job->prefixLength == 0 && !startPartitionedSearch(graph->input.number)){
+        //the quadrangulation belongs to another share
+        finishGraphOutput(graph);
+        return;
+    }
+    prepareMatchingSearch();
+    matchingCount = 0;
+    if(job->prefixLength == 0){
+        currentGraphJob = graph;
+        splitSearch = splitDepth > 0;
+        if(interleavedSearch){
+            startInterleavedSearch();
+        } else {
+            matchFirstFace();
+        }
+        splitSearch = FALSE;
+        partitionSearch = FALSE;
+    } else if(interleavedSearch){
+        resumeInterleavedSearch(job);
+    } else {
+        resumeMatchingSearch(job);
+    }
+    finishTask(graph, matchingCount, solvable - oldSolutionCount);
+}
+
+void addCountersToTotals(){
+    pthread_mutex_lock(&totalsLock);
+    moveCounters(&totalCounters);
+    pthread_mutex_unlock(&totalsLock);
+}
+
+/* Sets the counters of the calling thread to the totals of the workers.
+ */
+void takeCountersFromTotals(){
+    setCounters(&totalCounters);
+}
+
+void *runWorker(void *arg){
+    JOB job;
+    while(takeJob(&job)){
+        handleJob(&job);
+    }
+    addCountersToTotals();
+    return NULL;
+}
+
+pthread_t *workers;
+
+void startWorkers(){
+    pthread_attr_t attributes;
+    int i;
+    
+    workers = (pthread_t *) malloc(threadCount * sizeof(pthread_t));
+    if(workers == NULL){
+        fprintf(stderr, "Insufficient memory for worker threads -- exiting!\n");
+        exit(1);
+    }
+    //the counters of the run before, e.g. from a checkpoint
+    moveCounters(&writtenCounters);
+    //the thread-local state is allocated on the stack of each thread
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+    for(i = 0; i < threadCount; i++){
+        if(pthread_create(workers + i, &attributes, runWorker, NULL)){
+            fprintf(stderr, "Could not create worker thread -- exiting!\n");
+            exit(1);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+void stopWorkers(){
+    int i;
+    closeJobQueue();
+    for(i = 0; i < threadCount; i++){
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    //the calling thread can also have counted quadrangulations (plantri plugin)
+    addCountersToTotals();
+    addCounters(&totalCounters, &writtenCounters);
+    takeCountersFromTotals();
+}
+
+void processQuadrangulationsInParallel(FILE *file){
+    startWorkers();
+    
+    unsigned short code[MAXCODELENGTH];
+    int length;
+    INPUT_STATE input;
+    while (readNextQuadrangulation(code, &length, file)) {
+        if(isQuadrangulationSelected(numberOfQuadrangulations) &&
+                isQuadrangulationInShare(numberOfQuadrangulations)){
+            getInputState(&input);
+            addJob(code, length, &input);
+        }
+    }
+    
+    stopWorkers();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* With --procs the quadrangulations are handled by child processes, so that
+ * they don't share any state. The parent reads the input and sends the
+ * quadrangulations round-robin over a pipe to each child, together with the
+ * state of the input after them. The output of each child (stdout, stderr and
+ * the LaTeX stream) goes to temporary files. After each quadrangulation the
+ * child sends an entry over its index pipe: the state of the input, the end
+ * offsets of its output and the counters of the quadrangulation. While the
+ * children are running, a merge thread in the parent reads the entries in the
+ * order of the input, copies the output of each quadrangulation and adds its
+ * counters, so a checkpoint can be taken after each quadrangulation.
+ */
+
+typedef struct {
+    INPUT_STATE input;
+    long offsets[OUTPUT_STREAMS]; //the end of the output of the quadrangulation
+    char codeHeader[32]; //the header of the code in the output
+    COUNTERS counters; //the numbers of perfect matchings follow the entry
+    int perfectMatchingsCountsSize; //the number of pairs of key and value
+} OUTPUT_INDEX_ENTRY;
+
+typedef struct {
+    FILE *outputs[OUTPUT_STREAMS]; //NULL if the stream is not used
+    long offsets[OUTPUT_STREAMS]; //the end of the output that is copied
+    FILE *index;
+} CHILD_OUTPUT;
+
+int processCount = 1;
+
+FILE *outputIndex; //the index of the output of the child process
+
+CHILD_OUTPUT *childOutputs;
+unsigned long long int mergedGraphCount = 0;
+char childCodeHeader[32]; //the header of the code that the parent wrote
+
+void writeOutputIndex(INPUT_STATE *input, COUNTERS *counters){
+    OUTPUT_INDEX_ENTRY entry;
+    //human-readable output on stdout is already part of the code output
+    FILE *streams[OUTPUT_STREAMS] = {stdout, humanOutputFile == stdout ? NULL : humanOutputFile,
+            latexSummaryFile};
+    item *currentItem;
+    int i;
+    
+    memset(&entry, 0, sizeof(OUTPUT_INDEX_ENTRY));
+    entry.input = *input;
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(streams[i] != NULL){
+            fflush(streams[i]);
+            entry.offsets[i] = ftell(streams[i]);
+        }
+    }
+    if(codeHeader != NULL){
+        strncpy(entry.codeHeader, codeHeader, sizeof(entry.codeHeader) - 1);
+    }
+    entry.counters = *counters;
+    entry.counters.perfectMatchingsCounts = NULL;
+    for(currentItem = counters->perfectMatchingsCounts; currentItem != NULL; currentItem = currentItem->next){
+        entry.perfectMatchingsCountsSize++;
+    }
+    if(fwrite(&entry, sizeof(OUTPUT_INDEX_ENTRY), 1, outputIndex) != 1){
+        fprintf(stderr, "fwrite() failed -- exiting!\n");
+        exit(1);
+    }
+    for(currentItem = counters->perfectMatchingsCounts; currentItem != NULL; currentItem = currentItem->next){
+        int pair[2] = {currentItem->key, currentItem->value};
+        if(fwrite(pair, sizeof(int), 2, outputIndex) != 2){
+            fprintf(stderr, "fwrite() failed -- exiting!\n");
+            exit(1);
+        }
+    }
+    //the parent merges the output while the child is running
+    if(fflush(outputIndex)){
+        fprintf(stderr, "Could not send output index to parent process -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* Reads the next entry of the index of a child. Returns FALSE at the end of
+ * the index.
+ */
+boolean readOutputIndex(FILE *index, OUTPUT_INDEX_ENTRY *entry){
+    int i, pair[2];
+    if(fread(entry, sizeof(OUTPUT_INDEX_ENTRY), 1, index) != 1){
+        return FALSE;
+    }
+    entry->counters.perfectMatchingsCounts = NULL;
+    for(i = 0; i < entry->perfectMatchingsCountsSize; i++){
+        if(fread(pair, sizeof(int), 2, index) != 2){
+            freeCounters(&(entry->counters));
+            return FALSE;
+        }
+        entry->counters.perfectMatchingsCounts =
+                incrementBy(entry->counters.perfectMatchingsCounts, pair[0], pair[1]);
+    }
+    return TRUE;
+}
+
+void writeToProcess(FILE *pipe, unsigned short *code, int length, INPUT_STATE *input){
+    if(fwrite(input, sizeof(INPUT_STATE), 1, pipe) != 1 ||
+            fwrite(&length, sizeof(length), 1, pipe) != 1 ||
+            fwrite(code, sizeof(unsigned short), length, pipe) != length){
+        fprintf(stderr, "Could not send quadrangulation to child process -- exiting!\n");
+        exit(1);
+    }
+}
+
+boolean readFromParent(FILE *pipe, unsigned short *code, int *length, INPUT_STATE *input){
+    return fread(input, sizeof(INPUT_STATE), 1, pipe) == 1 &&
+            fread(length, sizeof(*length), 1, pipe) == 1 &&
+            *length <= MAXCODELENGTH &&
+            fread(code, sizeof(unsigned short), *length, pipe) == *length;
+}
+
+void runChildProcess(FILE *input, FILE *index){
+    unsigned short code[MAXCODELENGTH];
+    int length;
+    INPUT_STATE state;
+    COUNTERS counters;
+    
+    //the parent writes the header, and has the counters of the run before
+    codeHeaderWritten = TRUE;
+    memset(&counters, 0, sizeof(COUNTERS));
+    moveCounters(&counters);
+    freeCounters(&counters);
+    outputIndex = index;
+    graphOutputWritten = writeOutputIndex;
+    if(threadCount > 1){
+        startWorkers();
+    }
+    while(readFromParent(input, code, &length, &state)){
+        if(threadCount > 1){
+            addJob(code, length, &state);
+        } else {
+            handleQuadrangulation(code, state.number);
+            moveCounters(&counters);
+            writeOutputIndex(&state, &counters);
+            freeCounters(&counters);
+        }
+    }
+    if(threadCount > 1){
+        stopWorkers();
+    }
+    fclose(input);
+    if(latexSummaryFile != NULL){
+        fclose(latexSummaryFile);
+    }
+    fclose(outputIndex);
+    closePersistentCache();
+    exit(0);
+}
+
+FILE *createTemporaryFile(){
+    FILE *f = tmpfile();
+    if(f == NULL){
+        fprintf(stderr, "Could not create temporary file -- exiting!\n");
+        exit(1);
+    }
+    return f;
+}
+
+long getOutputSizeOfProcess(CHILD_OUTPUT *child, int stream){
+    struct stat fileStat;
+    if(fstat(fileno(child->outputs[stream]), &fileStat)){
+        fprintf(stderr, "Could not read output of child process -- exiting!\n");
+        exit(1);
+    }
+    return fileStat.st_size;
+}
+
+/* Copies the output of the child up to the given offset. The child shares
+ * the position in the file, so the output is read with pread().
+ */
+void copyOutputOfProcess(CHILD_OUTPUT *child, int stream, FILE *to, long end){
+    char buffer[65536];
+    ssize_t size;
+    while(child->offsets[stream] < end){
+        size_t part = end - child->offsets[stream] < sizeof(buffer) ? end - child->offsets[stream] : sizeof(buffer);
+        size = pread(fileno(child->outputs[stream]), buffer, part, child->offsets[stream]);
+        if(size < 0 && errno == EINTR){
+            continue;
+        } else if(size <= 0){
+            fprintf(stderr, "Could not read output of child process -- exiting!\n");
+            exit(1);
+        }
+        writeCollectedOutput(buffer, size, to);
+        child->offsets[stream] += size;
+    }
+}
+
+/* Copies the output of the quadrangulations of the children in the order of
+ * the input, until the index of the next child ends.
+ */
+void *mergeOutputOfProcesses(void *arg){
+    //the second stream of a child is its stderr: the human-readable output if
+    //stdout contains code, otherwise only diagnostics. The LaTeX stream of
+    //--latex-per-solution has no target.
+    FILE *targets[OUTPUT_STREAMS] = {stdout, stderr, latexSummaryFile};
+    OUTPUT_INDEX_ENTRY entry;
+    int i, j;
+    
+    for(i = 0; readOutputIndex(childOutputs[i].index, &entry); i = (i + 1) % processCount){
+        CHILD_OUTPUT *child = childOutputs + i;
+        for(j = 0; j < OUTPUT_STREAMS; j++){
+            if(child->outputs[j] == NULL || entry.offsets[j] == child->offsets[j]) continue;
+            if(j == CODE_OUTPUT){
+                strcpy(childCodeHeader, entry.codeHeader);
+                writeCodeHeader(childCodeHeader);
+            }
+            copyOutputOfProcess(child, j, targets[j], entry.offsets[j]);
+        }
+        countWrittenQuadrangulation(&(entry.input), &(entry.counters));
+        freeCounters(&(entry.counters));
+        mergedGraphCount++;
+    }
+    //a child that is still running can't send more entries
+    for(i = 0; i < processCount; i++){
+        fclose(childOutputs[i].index);
+    }
+    return NULL;
+}
+
+void processQuadrangulationsInProcesses(FILE *file){
+    pid_t children[processCount];
+    FILE *pipes[processCount];
+    pthread_t merger;
+    int i, j;
+    
+    childOutputs = (CHILD_OUTPUT *) calloc(processCount, sizeof(CHILD_OUTPUT));
+    if(childOutputs == NULL){
+        fprintf(stderr, "Insufficient memory for child processes -- exiting!\n");
+        exit(1);
+    }
+    
+    //nothing should be buffered twice
+    fflush(stdout);
+    fflush(stderr);
+    if(latexSummaryFile != NULL){
+        fflush(latexSummaryFile);
+    }
+    //a child that failed is reported instead
+    signal(SIGPIPE, SIG_IGN);
+    
+    for(i = 0; i < processCount; i++){
+        int fd[2], indexFd[2];
+        if(pipe(fd) || pipe(indexFd)){
+            fprintf(stderr, "Could not create pipe -- exiting!\n");
+            exit(1);
         }
-        edgeCounter++;
-        codePosition++;
-        for (j = 1; code[codePosition]; j++, codePosition++) {
-            if (j == MAXVAL) {
-                fprintf(stderr, "MAXVAL too small: %d\n", MAXVAL);
-                exit(0);
-            }
-            edges[edgeCounter].start = i;
-            edges[edgeCounter].end = code[codePosition] - 1;
-            edges[edgeCounter].prev = edges + edgeCounter - 1;
-            edges[edgeCounter].next = edges + edgeCounter + 1;
-            edges[edgeCounter].allowedInFaceMatching = TRUE;
-            if(code[codePosition] - 1 < i){
-                inverse = findEdge(code[codePosition]-1, i);
-                edges[edgeCounter].inverse = inverse;
-                inverse->inverse = edges + edgeCounter;
-            } else {
-                edges[edgeCounter].inverse = NULL;
+        childOutputs[i].outputs[CODE_OUTPUT] = createTemporaryFile();
+        childOutputs[i].outputs[HUMAN_OUTPUT] = createTemporaryFile();
+        childOutputs[i].outputs[LATEX_OUTPUT] = latexSummaryFile == NULL && !latexPerSolution ?
+                NULL : createTemporaryFile();
+        children[i] = fork();
+        if(children[i] < 0){
+            fprintf(stderr, "Could not create child process -- exiting!\n");
+            exit(1);
+        } else if(children[i] == 0){
+            close(fd[1]);
+            close(indexFd[0]);
+            for(j = 0; j < i; j++){
+                fclose(pipes[j]);
+                fclose(childOutputs[j].index);
             }
-            edgeCounter++;
+            dup2(fileno(childOutputs[i].outputs[CODE_OUTPUT]), STDOUT_FILENO);
+            dup2(fileno(childOutputs[i].outputs[HUMAN_OUTPUT]), STDERR_FILENO);
+            //with --latex-per-solution the child collects the solutions in
+            //the LaTeX stream
+            latexSummaryFile = childOutputs[i].outputs[LATEX_OUTPUT];
+            runChildProcess(fdopen(fd[0], "r"), fdopen(indexFd[1], "w"));
         }
-        firstedge[i]->prev = edges + edgeCounter - 1;
-        edges[edgeCounter-1].next = firstedge[i];
-        degree[i] = j;
-        
-        codePosition++; /* read the closing 0 */
+        close(fd[0]);
+        close(indexFd[1]);
+        pipes[i] = fdopen(fd[1], "w");
+        childOutputs[i].index = fdopen(indexFd[0], "r");
     }
     
-    ne = edgeCounter;
+    //the counters of the run before, e.g. from a checkpoint
+    moveCounters(&writtenCounters);
+    if(pthread_create(&merger, NULL, mergeOutputOfProcesses, NULL)){
+        fprintf(stderr, "Could not create thread -- exiting!\n");
+        exit(1);
+    }
     
-    makeDual();
+    unsigned short code[MAXCODELENGTH];
+    int length;
+    unsigned long long int sentCount = 0;
+    INPUT_STATE input;
+    while (readNextQuadrangulation(code, &length, file)) {
+        if(isQuadrangulationSelected(numberOfQuadrangulations) &&
+                isQuadrangulationInShare(numberOfQuadrangulations)){
+            getInputState(&input);
+            writeToProcess(pipes[sentCount % processCount], code, length, &input);
+            sentCount++;
+        }
+    }
+    for(i = 0; i < processCount; i++){
+        fclose(pipes[i]);
+    }
+    pthread_join(merger, NULL);
     
-    // nv - ne/2 + nf = 2
+    boolean failed = mergedGraphCount != sentCount;
+    for(i = 0; i < processCount; i++){
+        int status;
+        if(waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            failed = TRUE;
+        }
+    }
+    if(failed){
+        //show the error messages of the children
+        for(i = 0; i < processCount; i++){
+            childOutputs[i].offsets[HUMAN_OUTPUT] = 0;
+            copyOutputOfProcess(childOutputs + i, HUMAN_OUTPUT, stderr,
+                    getOutputSizeOfProcess(childOutputs + i, HUMAN_OUTPUT));
+        }
+        fprintf(stderr, "A child process failed -- exiting!\n");
+        exit(1);
+    }
+    //anything that was written after the last quadrangulation
+    FILE *targets[OUTPUT_STREAMS] = {stdout, stderr, latexSummaryFile};
+    for(i = 0; i < processCount; i++){
+        for(j = 0; j < OUTPUT_STREAMS; j++){
+            if(childOutputs[i].outputs[j] != NULL){
+                copyOutputOfProcess(childOutputs + i, j, targets[j],
+                        getOutputSizeOfProcess(childOutputs + i, j));
+                fclose(childOutputs[i].outputs[j]);
+            }
+        }
+    }
+    free(childOutputs);
+    setCounters(&writtenCounters);
 }
 
-/**
- * 
- * @param code
- * @param laenge
- * @param file
- * @return returns 1 if a code was read and 0 otherwise. Exits in case of error.
+//////////////////////////////////////////////////////////////////////////////
+
+/* With --checkpoint the progress of a run is saved regularly, so that it can
+ * be continued with --resume after it was interrupted. A checkpoint contains
+ * the number of quadrangulations that were read, the position in the input,
+ * all counters and the positions in the output files. A timer marks that a
+ * checkpoint is due. After the next quadrangulation of which the output is
+ * written (by the main loop, the reorder buffer of -j or the merge thread of
+ * --procs) a snapshot of this state is taken, so that it is consistent. A
+ * writer thread writes the snapshot to a temporary file, which then replaces
+ * the previous checkpoint, while the run continues.
+ *
+ * On --resume the input is positioned after the last quadrangulation in the
+ * checkpoint: by seeking if the input is a file, and otherwise by skipping the
+ * quadrangulations. The output files are truncated to their positions in the
+ * checkpoint, so they should be opened for appending (>>) when resuming.
  */
-int readPlanarCode(unsigned short code[], int *length, FILE *file) {
-    static int first = 1;
-    unsigned char c;
-    char testheader[20];
-    int bufferSize, zeroCounter;
-    
-    int readCount;
 
+#define CHECKPOINT_VERSION 2
 
-    if (first) {
-        first = 0;
+char *checkpointFileName = NULL;
+int checkpointInterval = 300; //seconds
+boolean resumeFromCheckpoint = FALSE;
 
-        if (fread(&testheader, sizeof (unsigned char), 15, file) != 15) {
-            fprintf(stderr, "can't read header ((1)file too small)-- exiting\n");
-            exit(1);
-        }
-        testheader[15] = 0;
-        if (strcmp(testheader, ">>planar_code<<") == 0) {
-            
-        } else {
-            fprintf(stderr, "No planarcode header detected -- exiting!\n");
-            exit(1);
-        }
+volatile sig_atomic_t checkpointDue = FALSE;
+
+typedef struct {
+    INPUT_STATE input;
+    COUNTERS counters;
+    unsigned long long int outputSolutionCount;
+    char *codeHeader; //NULL if no header was written
+    long outputPositions[OUTPUT_STREAMS];
+} CHECKPOINT;
+
+CHECKPOINT pendingCheckpoint;
+boolean checkpointPending = FALSE;
+boolean checkpointsStopped = FALSE;
+boolean checkpointWriterStarted = FALSE;
+pthread_t checkpointWriter;
+pthread_mutex_t checkpointLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t checkpointTaken = PTHREAD_COND_INITIALIZER;
+
+void markCheckpointDue(int signal){
+    checkpointDue = TRUE;
+}
+
+/* Returns the position in the file, or -1 if the file is not a regular file.
+ */
+long getOutputPosition(FILE *f){
+    struct stat fileStat;
+    if(f == NULL || fflush(f) || fstat(fileno(f), &fileStat) || !S_ISREG(fileStat.st_mode)){
+        return -1;
     }
+    return ftell(f);
+}
 
-    /* possibly removing interior headers -- only done for planarcode */
-    if (fread(&c, sizeof (unsigned char), 1, file) == 0){
-        //nothing left in file
-        return (0);
+void restoreOutputPosition(FILE *f, long position, char *name){
+    struct stat fileStat;
+    if(position < 0) return;
+    if(f == NULL || fstat(fileno(f), &fileStat) || !S_ISREG(fileStat.st_mode)){
+        fprintf(stderr, "Warning: the %s was a file at the checkpoint, but is not a file now.\n", name);
+        return;
+    }
+    if(fileStat.st_size < position){
+        fprintf(stderr, "The %s is shorter than at the checkpoint (open it with >>) -- exiting!\n", name);
+        exit(1);
     }
+    if(ftruncate(fileno(f), position) || fseek(f, position, SEEK_SET)){
+        fprintf(stderr, "Could not restore the position in the %s -- exiting!\n", name);
+        exit(1);
+    }
+}
+
+void writeOptionsForCheckpoint(FILE *f){
+    fprintf(f, "options %d %d %d %d %d %s %llu %llu %d %d\n",
+            onlyConvex, generateSTCQ4, mirrorImagesAreDistinct, interleavedSearch,
+            breakSymmetry, filterRangeCount > 0 ? filterDescription : "0",
+            partitionResidue, partitionModulus, splitDepth, isBlockPartition);
+}
+
+/* Takes a snapshot of the state after a quadrangulation. The counters are
+ * copied.
+ */
+void getCheckpoint(CHECKPOINT *checkpoint, INPUT_STATE *input, COUNTERS *counters){
+    checkpoint->input = *input;
+    memset(&(checkpoint->counters), 0, sizeof(COUNTERS));
+    addCounters(&(checkpoint->counters), counters);
+    checkpoint->outputSolutionCount = outputSolutionCount;
+    checkpoint->codeHeader = codeHeaderWritten ? codeHeader : NULL;
+    checkpoint->outputPositions[CODE_OUTPUT] = getOutputPosition(stdout);
+    //human-readable output on stdout is already part of the code output
+    checkpoint->outputPositions[HUMAN_OUTPUT] =
+            humanOutputFile == stdout ? -1 : getOutputPosition(humanOutputFile);
+    checkpoint->outputPositions[LATEX_OUTPUT] = getOutputPosition(latexSummaryFile);
+}
+
+void writeCheckpoint(CHECKPOINT *checkpoint){
+    char temporaryFileName[strlen(checkpointFileName) + 5];
+    FILE *streams[OUTPUT_STREAMS] = {stdout, humanOutputFile, latexSummaryFile};
+    item *currentItem;
+    int i;
     
-    if (c == '>'){
-        // could be a header, or maybe just a 62 (which is also possible for unsigned char
-        code[0] = c;
-        bufferSize = 1;
-        zeroCounter = 0;
-        code[1] = (unsigned short) getc(file);
-        if (code[1] == 0) zeroCounter++;
-        code[2] = (unsigned short) getc(file);
-        if (code[2] == 0) zeroCounter++;
-        bufferSize = 3;
-        // 3 characters were read and stored in buffer
-        if ((code[1] == '>') && (code[2] == 'p')) /*we are sure that we're dealing with a header*/ {
-            while ((c = getc(file)) != '<');
-            /* read 2 more characters: */
-            c = getc(file);
-            if (c != '<') {
-                fprintf(stderr, "Problems with header -- single '<'\n");
-                exit(1);
-            }
-            if (!fread(&c, sizeof (unsigned char), 1, file)){
-                //nothing left in file
-                return (0);
-            }
-            bufferSize = 1;
-            zeroCounter = 0;
+    //the output up to the positions should be on disk before the checkpoint
+    for(i = 0; i < OUTPUT_STREAMS; i++){
+        if(checkpoint->outputPositions[i] >= 0){
+            fsync(fileno(streams[i]));
         }
-    } else {
-        //no header present
-        bufferSize = 1;
-        zeroCounter = 0;
     }
+    
+    sprintf(temporaryFileName, "%s.tmp", checkpointFileName);
+    FILE *f = fopen(temporaryFileName, "w");
+    if(f == NULL){
+        fprintf(stderr, "Could not write checkpoint %s -- exiting!\n", temporaryFileName);
+        exit(1);
+    }
+    fprintf(f, "stcq_checkpoint %d\n", CHECKPOINT_VERSION);
+    writeOptionsForCheckpoint(f);
+    fprintf(f, "quadrangulations %llu\n", checkpoint->input.number);
+    fprintf(f, "input_position %ld\n", checkpoint->input.position);
+    fprintf(f, "vertices %d\n", checkpoint->input.vertexCount);
+    fprintf(f, "unused_quadrangulations %llu\n", checkpoint->counters.unusedGraphCount);
+    fprintf(f, "assignments %llu\n", checkpoint->counters.assignmentCount);
+    fprintf(f, "solvable %llu\n", checkpoint->counters.solvable);
+    fprintf(f, "solvable_and_canonical %llu\n", checkpoint->counters.solvableAndCanonical);
+    fprintf(f, "rejected_by_coefficient_diff %llu\n", checkpoint->counters.rejectedByCoefficientDiff);
+    fprintf(f, "feasibility_cache_hits %llu\n", checkpoint->counters.feasibilityCacheHits);
+    fprintf(f, "feasibility_cache_misses %llu\n", checkpoint->counters.feasibilityCacheMisses);
+    fprintf(f, "persistent_cache_hits %llu\n", checkpoint->counters.persistentCacheHits);
+    fprintf(f, "persistent_cache_records_loaded %llu\n", checkpoint->counters.persistentCacheRecordsLoaded);
+    fprintf(f, "persistent_cache_records_written %llu\n", checkpoint->counters.persistentCacheRecordsWritten);
+    fprintf(f, "output_solutions %llu\n", checkpoint->outputSolutionCount);
+    fprintf(f, "code_header %s\n", checkpoint->codeHeader != NULL ? checkpoint->codeHeader : "-");
+    fprintf(f, "output_positions %ld %ld %ld\n", checkpoint->outputPositions[CODE_OUTPUT],
+            checkpoint->outputPositions[HUMAN_OUTPUT], checkpoint->outputPositions[LATEX_OUTPUT]);
+    for(currentItem = checkpoint->counters.perfectMatchingsCounts; currentItem != NULL; currentItem = currentItem->next){
+        fprintf(f, "perfect_matchings %d %d\n", currentItem->key, currentItem->value);
+    }
+    fprintf(f, "end\n");
+    if(fflush(f) || fsync(fileno(f)) || fclose(f) || rename(temporaryFileName, checkpointFileName)){
+        fprintf(stderr, "Could not write checkpoint %s -- exiting!\n", checkpointFileName);
+        exit(1);
+    }
+}
 
-    if (c != 0) /* unsigned chars would be sufficient */ {
-        code[0] = c;
-        if (code[0] > MAXN) {
-            fprintf(stderr, "Constant N too small %d > %d \n", code[0], MAXN);
-            exit(1);
-        }
-        while (zeroCounter < code[0]) {
-            code[bufferSize] = (unsigned short) getc(file);
-            if (code[bufferSize] == 0) zeroCounter++;
-            bufferSize++;
+void *runCheckpointWriter(void *arg){
+    CHECKPOINT checkpoint;
+    pthread_mutex_lock(&checkpointLock);
+    while(TRUE){
+        while(!checkpointPending && !checkpointsStopped){
+            pthread_cond_wait(&checkpointTaken, &checkpointLock);
         }
-    } else {
-        readCount = fread(code, sizeof (unsigned short), 1, file);
-        if(!readCount){
-            fprintf(stderr, "Unexpected EOF.\n");
+        if(!checkpointPending) break;
+        checkpoint = pendingCheckpoint;
+        checkpointPending = FALSE;
+        pthread_mutex_unlock(&checkpointLock);
+        writeCheckpoint(&checkpoint);
+        freeCounters(&(checkpoint.counters));
+        alarm(checkpointInterval);
+        pthread_mutex_lock(&checkpointLock);
+    }
+    pthread_mutex_unlock(&checkpointLock);
+    return NULL;
+}
+
+/* Takes a snapshot of the state after the quadrangulation if a checkpoint is
+ * due, and hands it to the writer thread. This is called by the thread that
+ * writes the output.
+ */
+void takeCheckpointIfDue(INPUT_STATE *input, COUNTERS *counters){
+    CHECKPOINT checkpoint;
+    if(!checkpointDue) return;
+    checkpointDue = FALSE;
+    getCheckpoint(&checkpoint, input, counters);
+    pthread_mutex_lock(&checkpointLock);
+    if(!checkpointWriterStarted){
+        if(pthread_create(&checkpointWriter, NULL, runCheckpointWriter, NULL)){
+            fprintf(stderr, "Could not create checkpoint thread -- exiting!\n");
             exit(1);
         }
-        if (code[0] > MAXN) {
-            fprintf(stderr, "Constant N too small %d > %d \n", code[0], MAXN);
-            exit(1);
+        checkpointWriterStarted = TRUE;
+    }
+    if(checkpointPending){
+        //the writer didn't start on the previous snapshot yet
+        freeCounters(&(pendingCheckpoint.counters));
+    }
+    pendingCheckpoint = checkpoint;
+    checkpointPending = TRUE;
+    pthread_cond_signal(&checkpointTaken);
+    pthread_mutex_unlock(&checkpointLock);
+}
+
+void checkpointError(char *message){
+    fprintf(stderr, "Error in checkpoint %s: %s -- exiting!\n", checkpointFileName, message);
+    exit(1);
+}
+
+/* Positions the input after the given number of quadrangulations.
+ */
+void skipInput(FILE *file, unsigned long long int count, long position){
+    unsigned short code[MAXCODELENGTH];
+    int length;
+    unsigned long long int i;
+    
+    //the first quadrangulation is always read, so the header is checked
+    if(!readPlanarCode(code, &length, file)){
+        checkpointError("the input is shorter than at the checkpoint");
+    }
+    if(position >= 0 && seekInput(position)){
+        return;
+    }
+    for(i = 1; i < count; i++){
+        if(!readPlanarCode(code, &length, file)){
+            checkpointError("the input is shorter than at the checkpoint");
         }
-        bufferSize = 1;
-        zeroCounter = 0;
-        while (zeroCounter < code[0]) {
-            readCount = fread(code + bufferSize, sizeof (unsigned short), 1, file);
-            if(!readCount){
-                fprintf(stderr, "Unexpected EOF.\n");
-                exit(1);
+    }
+}
+
+void resumeCheckpoint(){
+    //the options line contains the list of the filter
+    size_t lineSize = 1000 + (filterDescription == NULL ? 0 : strlen(filterDescription));
+    char line[lineSize], key[100], options[lineSize], header[100];
+    int version, key1, value1;
+    long inputPosition = -1;
+    long outputPositions[OUTPUT_STREAMS] = {-1, -1, -1};
+    boolean complete = FALSE;
+    
+    FILE *f = fopen(checkpointFileName, "r");
+    if(f == NULL){
+        fprintf(stderr, "Could not open checkpoint %s -- exiting!\n", checkpointFileName);
+        exit(1);
+    }
+    if(fgets(line, sizeof(line), f) == NULL ||
+            sscanf(line, "stcq_checkpoint %d", &version) != 1 || version != CHECKPOINT_VERSION){
+        checkpointError("not a compatible checkpoint");
+    }
+    
+    //the options should be the same as in the interrupted run
+    FILE *o = fmemopen(options, sizeof(options), "w");
+    writeOptionsForCheckpoint(o);
+    fclose(o);
+    if(fgets(line, sizeof(line), f) == NULL || strcmp(line, options) != 0){
+        checkpointError("the options differ from those of the interrupted run");
+    }
+    
+    while(fgets(line, sizeof(line), f) != NULL){
+        if(sscanf(line, "%99s", key) != 1) continue;
+        char *value = line + strlen(key);
+        if(strcmp(key, "quadrangulations") == 0){
+            numberOfQuadrangulations = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "input_position") == 0){
+            inputPosition = strtol(value, NULL, 10);
+        } else if(strcmp(key, "vertices") == 0){
+            inputVertexCount = atoi(value);
+        } else if(strcmp(key, "unused_quadrangulations") == 0){
+            unusedGraphCount = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "assignments") == 0){
+            assignmentCount = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "solvable") == 0){
+            solvable = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "solvable_and_canonical") == 0){
+            solvableAndCanonical = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "rejected_by_coefficient_diff") == 0){
+            rejectedByCoefficientDiff = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "feasibility_cache_hits") == 0){
+            feasibilityCacheHits = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "feasibility_cache_misses") == 0){
+            feasibilityCacheMisses = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_hits") == 0){
+            persistentCacheHits = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_records_loaded") == 0){
+            persistentCacheRecordsLoaded = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_records_written") == 0){
+            persistentCacheRecordsWritten = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "output_solutions") == 0){
+            outputSolutionCount = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "code_header") == 0){
+            if(sscanf(value, "%99s", header) == 1 && strcmp(header, "-") != 0){
+                //the header is already in the output
+                codeHeaderWritten = TRUE;
             }
-            if (code[bufferSize] == 0) zeroCounter++;
-            bufferSize++;
+        } else if(strcmp(key, "output_positions") == 0){
+            if(sscanf(value, "%ld %ld %ld", outputPositions + CODE_OUTPUT,
+                    outputPositions + HUMAN_OUTPUT, outputPositions + LATEX_OUTPUT) != 3){
+                checkpointError("malformed output positions");
+            }
+        } else if(strcmp(key, "perfect_matchings") == 0){
+            if(sscanf(value, "%d %d", &key1, &value1) != 2){
+                checkpointError("malformed perfect matchings");
+            }
+            perfect_matchings_counts = incrementBy(perfect_matchings_counts, key1, value1);
+        } else if(strcmp(key, "end") == 0){
+            complete = TRUE;
         }
     }
+    fclose(f);
+    if(!complete){
+        checkpointError("the checkpoint is incomplete");
+    }
+    
+    restoreOutputPosition(stdout, outputPositions[CODE_OUTPUT], "standard output");
+    restoreOutputPosition(humanOutputFile, outputPositions[HUMAN_OUTPUT], "human-readable output");
+    restoreOutputPosition(latexSummaryFile, outputPositions[LATEX_OUTPUT], "LaTeX file");
+    //with an offset index the next quadrangulation is looked up in the index
+    if(numberOfQuadrangulations > 0 && offsetIndex == NULL){
+        skipInput(stdin, numberOfQuadrangulations, inputPosition);
+    }
+}
 
-    *length = bufferSize;
-    return (1);
-
+void startCheckpoints(){
+    if(resumeFromCheckpoint){
+        resumeCheckpoint();
+    }
+    signal(SIGALRM, markCheckpointDue);
+    alarm(checkpointInterval);
+}
 
+/* Waits for the writer thread, and writes the checkpoint at the end of the
+ * run.
+ */
+void finishCheckpoints(){
+    CHECKPOINT checkpoint;
+    INPUT_STATE input;
+    COUNTERS counters;
+    
+    pthread_mutex_lock(&checkpointLock);
+    checkpointsStopped = TRUE;
+    pthread_cond_signal(&checkpointTaken);
+    pthread_mutex_unlock(&checkpointLock);
+    if(checkpointWriterStarted){
+        pthread_join(checkpointWriter, NULL);
+    }
+    alarm(0);
+    
+    getInputState(&input);
+    getCounters(&counters);
+    getCheckpoint(&checkpoint, &input, &counters);
+    writeCheckpoint(&checkpoint);
+    freeCounters(&(checkpoint.counters));
 }
 
-//====================== USAGE =======================
+//////////////////////////////////////////////////////////////////////////////
 
 void help(char *name){
     fprintf(stderr, "The program %s calculates spherical tilings by congruent qaudrangles\n", name);
-    fprintf(stderr, "that have any of the input graphs as underlying graph.\n\n", name);
+    fprintf(stderr, "that have any of the input graphs as underlying graph.\n\n");
     fprintf(stderr, "Usage\n=====\n");
     fprintf(stderr, " %s [options]\n\n", name);
     fprintf(stderr, "Without any options, this program will generate spherical tilings by\n");
@@ -2317,20 +5543,82 @@ void help(char *name){
     fprintf(stderr, "       Also allow concave quadrangles (currently not supported)\n");
     fprintf(stderr, "    -s, --statistics\n");
     fprintf(stderr, "       Print extra statistics\n");
-    fprintf(stderr, "    -f, --filter number\n");
-    fprintf(stderr, "       Only perform the calculations for the graph with the given number.\n");
+    fprintf(stderr, "    -f, --filter list\n");
+    fprintf(stderr, "       Only perform the calculations for the graphs with the given numbers. The\n");
+    fprintf(stderr, "       list consists of numbers and ranges separated by commas, e.g. 5,10-20.\n");
+    fprintf(stderr, "    --index filename\n");
+    fprintf(stderr, "       Use the given offset index of the input file to seek to the graphs that\n");
+    fprintf(stderr, "       are handled (see -f, --res and --blocks), instead of reading all graphs.\n");
+    fprintf(stderr, "       If the file doesn't exist, the index is built in one pass over the input.\n");
     fprintf(stderr, "    -r, --relabel\n");
     fprintf(stderr, "       Relabel the quadrangulations that are used as input. The program requires\n");
     fprintf(stderr, "       the graphs to have a BFS-labelling compatible with the embedding. If the\n");
     fprintf(stderr, "       input comes from plantri, then relabelling is not necessary.\n");
+    fprintf(stderr, "    -j, --jobs number\n");
+    fprintf(stderr, "       Handle the quadrangulations in the given number of threads. The output\n");
+    fprintf(stderr, "       is buffered and written in the order of the input.\n");
+    fprintf(stderr, "    --procs number\n");
+    fprintf(stderr, "       Handle the quadrangulations in the given number of processes. Each\n");
+    fprintf(stderr, "       process can use -j threads. The output of the processes is collected\n");
+    fprintf(stderr, "       and written in the order of the input when all processes are done.\n");
+    fprintf(stderr, "    --splitdepth depth\n");
+    fprintf(stderr, "       With -j: split the search for each quadrangulation into subtasks after\n");
+    fprintf(stderr, "       the given number of matched pairs of faces (or decided faces with\n");
+    fprintf(stderr, "       --interleaved), so that several threads can work on one quadrangulation.\n");
+    fprintf(stderr, "    --res r --mod m\n");
+    fprintf(stderr, "       Only do part r of the work, when it is split into m parts (0 <= r < m).\n");
+    fprintf(stderr, "       By default the quadrangulations are split. With --splitdepth, each\n");
+    fprintf(stderr, "       quadrangulation is handled, but the subtrees at the split depth are\n");
+    fprintf(stderr, "       split. Then only the numbers of assignments and solutions of the parts\n");
+    fprintf(stderr, "       add up to those of the complete run.\n");
+    fprintf(stderr, "    --blocks\n");
+    fprintf(stderr, "       With --res and --mod: split the input in m blocks of consecutive graphs\n");
+    fprintf(stderr, "       instead of taking every m-th graph, so each part only reads its own\n");
+    fprintf(stderr, "       block. Requires --index.\n");
+    fprintf(stderr, "    --interleaved\n");
+    fprintf(stderr, "       Decide the matching edge and the direction of each face together, so\n");
+    fprintf(stderr, "       that partial matchings can already be rejected. The perfect matchings\n");
+    fprintf(stderr, "       are not counted in this mode.\n");
+    fprintf(stderr, "    --nosymmetrybreaking\n");
+    fprintf(stderr, "       Only reject non-canonical angle assignments after they are solved. By\n");
+    fprintf(stderr, "       default partial angle assignments that can only lead to non-canonical\n");
+    fprintf(stderr, "       assignments are pruned, so they are not counted as solvable.\n");
     fprintf(stderr, "    --mirror\n");
     fprintf(stderr, "       Makes the program consider mirror images as distinct.\n");
+    fprintf(stderr, "    --nocache\n");
+    fprintf(stderr, "       Solve each system, even if the same system was already solved before.\n");
+    fprintf(stderr, "    --checkpoint filename\n");
+    fprintf(stderr, "       Save the progress to the given file regularly and at the end, so that an\n");
+    fprintf(stderr, "       interrupted run can be continued with --resume.\n");
+    fprintf(stderr, "    --checkpointinterval seconds\n");
+    fprintf(stderr, "       The time between two checkpoints. The default is 300 seconds.\n");
+    fprintf(stderr, "    --resume\n");
+    fprintf(stderr, "       Continue the run from the checkpoint with the same options and the same\n");
+    fprintf(stderr, "       input. The output files are truncated to their size at the checkpoint\n");
+    fprintf(stderr, "       and then extended, so redirect the output with >>.\n");
+    fprintf(stderr, "    --cachefile filename\n");
+    fprintf(stderr, "       Share the solved systems with other runs through the given file. Several\n");
+    fprintf(stderr, "       processes can use the same file at the same time. Ignored with --nocache.\n");
     fprintf(stderr, "\nOutput options\n==============\n");
     fprintf(stderr, "    -o, --output format\n");
     fprintf(stderr, "       Specifies the export format where format is one of\n");
-    fprintf(stderr, "           c, code    code depends on the generated type\n");
-    fprintf(stderr, "           h, human   human-readable output\n");
+    fprintf(stderr, "           c, code    code depends on the generated type: the tilings are\n");
+    fprintf(stderr, "                      written to stdout as >>angle_assignment<<\n");
+    fprintf(stderr, "           h, human   human-readable output to stdout\n");
     fprintf(stderr, "           n, none    no output: only count (default)\n");
+    fprintf(stderr, "    --anglevalues format\n");
+    fprintf(stderr, "       With -o c: write the values of the angles after each angle assignment.\n");
+    fprintf(stderr, "       format is one of\n");
+    fprintf(stderr, "           r, rational   numerator and denominator of each angle as 64-bit\n");
+    fprintf(stderr, "                         integers (header >>angle_assignment rational<<)\n");
+    fprintf(stderr, "           d, double     each angle as a double\n");
+    fprintf(stderr, "                         (header >>angle_assignment double<<)\n");
+    fprintf(stderr, "    --output-file filename\n");
+    fprintf(stderr, "       Write the output to the given file instead of stdout. The summary and\n");
+    fprintf(stderr, "       the diagnostics are still written to stderr.\n");
+    fprintf(stderr, "    --summary filename\n");
+    fprintf(stderr, "       Also write the summary as JSON to the given file. The summaries of the\n");
+    fprintf(stderr, "       parts of a run with --res and --mod can be combined with stcq_merge.\n");
     fprintf(stderr, "    --usedquadrangulations\n");
     fprintf(stderr, "       Only output quadrangulations that might be used in a STCQ.\n");
     fprintf(stderr, "    --unusedquadrangulations\n");
@@ -2354,10 +5642,12 @@ void usage(char *name){
     fprintf(stderr, "For more information type: %s -h \n\n", name);
 }
 
-int main(int argc, char *argv[]){
-
-    /*=========== commandline parsing ===========*/
+#define CONTINUE_RUN -1
 
+/* Parses and checks the options. Returns CONTINUE_RUN if the quadrangulations
+ * should be handled, and otherwise the exit status.
+ */
+int parseOptions(int argc, char *argv[]){
     int c;
     char *name = argv[0];
     static struct option long_options[] = {
@@ -2368,17 +5658,35 @@ int main(int argc, char *argv[]){
         {"group", no_argument, &includeGroup, TRUE},
         {"latex-per-solution", required_argument, NULL, 0},
         {"mirror", no_argument, NULL, 0},
+        {"nocache", no_argument, NULL, 0},
+        {"cachefile", required_argument, NULL, 0},
+        {"interleaved", no_argument, NULL, 0},
+        {"nosymmetrybreaking", no_argument, NULL, 0},
+        {"splitdepth", required_argument, NULL, 0},
+        {"res", required_argument, NULL, 0},
+        {"mod", required_argument, NULL, 0},
+        {"summary", required_argument, NULL, 0},
+        {"procs", required_argument, NULL, 0},
+        {"checkpoint", required_argument, NULL, 0},
+        {"checkpointinterval", required_argument, NULL, 0},
+        {"resume", no_argument, NULL, 0},
+        {"index", required_argument, NULL, 0},
+        {"blocks", no_argument, NULL, 0},
+        {"anglevalues", required_argument, NULL, 0},
+        {"output-file", required_argument, NULL, 0},
         {"help", no_argument, NULL, 'h'},
         {"concave", no_argument, NULL, 'c'},
         {"statistics", no_argument, NULL, 's'},
         {"type", required_argument, NULL, 't'},
         {"output", required_argument, NULL, 'o'},
         {"filter", required_argument, NULL, 'f'},
-        {"relabel", no_argument, NULL, 'r'}
+        {"relabel", no_argument, NULL, 'r'},
+        {"jobs", required_argument, NULL, 'j'},
+        {0, 0, 0, 0}
     };
     int option_index = 0;
 
-    while ((c = getopt_long(argc, argv, "hcst:o:f:4r", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "hcst:o:f:4rj:", long_options, &option_index)) != -1) {
         switch (c) {
             case 0:
                 switch (option_index) {
@@ -2389,7 +5697,7 @@ int main(int argc, char *argv[]){
                         outputSolution = FALSE;
                         break;
                     case 2:
-                        latexSummaryFile = fopen(optarg, "w");
+                        latexFileName = optarg;
                         latexPerSolution = FALSE;
                         break;
                     case 3:
@@ -2398,13 +5706,74 @@ int main(int argc, char *argv[]){
                     case 5:
                         latexPerSolution = TRUE;
                         latexBaseName = optarg;
-                        if(latexSummaryFile != NULL){
-                            fclose(latexSummaryFile);
-                        }
+                        latexFileName = NULL;
                         break;
                     case 6:
                         mirrorImagesAreDistinct = TRUE;
                         break;
+                    case 7:
+                        useFeasibilityCache = FALSE;
+                        break;
+                    case 8:
+                        persistentCacheFileName = optarg;
+                        break;
+                    case 9:
+                        interleavedSearch = TRUE;
+                        break;
+                    case 10:
+                        breakSymmetry = FALSE;
+                        break;
+                    case 11:
+                        splitDepth = atoi(optarg);
+                        break;
+                    case 12:
+                        partitionResidue = strtoull(optarg, NULL, 10);
+                        break;
+                    case 13:
+                        partitionModulus = strtoull(optarg, NULL, 10);
+                        break;
+                    case 14:
+                        summaryFileName = optarg;
+                        break;
+                    case 15:
+                        processCount = atoi(optarg);
+                        if(processCount < 1){
+                            fprintf(stderr, "The number of processes should be at least 1.\n");
+                            usage(name);
+                            return EXIT_FAILURE;
+                        }
+                        break;
+                    case 16:
+                        checkpointFileName = optarg;
+                        break;
+                    case 17:
+                        checkpointInterval = atoi(optarg);
+                        if(checkpointInterval < 1){
+                            fprintf(stderr, "The checkpoint interval should be at least 1 second.\n");
+                            usage(name);
+                            return EXIT_FAILURE;
+                        }
+                        break;
+                    case 18:
+                        resumeFromCheckpoint = TRUE;
+                        break;
+                    case 19:
+                        offsetIndexFileName = optarg;
+                        break;
+                    case 20:
+                        isBlockPartition = TRUE;
+                        break;
+                    case 21:
+                        angleValueFormat = optarg[0];
+                        if(angleValueFormat != 'r' && angleValueFormat != 'd'){
+                            fprintf(stderr, "Illegal angle value format %s.\n", optarg);
+                            usage(name);
+                            return EXIT_FAILURE;
+                        }
+                        break;
+                    case 22:
+                        outputFileName = optarg;
+                        break;
                     default:
                         fprintf(stderr, "Illegal option.\n");
                         usage(name);
@@ -2451,11 +5820,23 @@ int main(int argc, char *argv[]){
                 }
                 break;
             case 'f':
-                filterOnly = atoi(optarg);
+                if(!parseFilter(optarg)){
+                    fprintf(stderr, "Illegal filter %s.\n", optarg);
+                    usage(name);
+                    return EXIT_FAILURE;
+                }
                 break;
             case 'r':
                 relabelInputQuadrangulation = TRUE;
                 break;
+            case 'j':
+                threadCount = atoi(optarg);
+                if(threadCount < 1){
+                    fprintf(stderr, "The number of threads should be at least 1.\n");
+                    usage(name);
+                    return EXIT_FAILURE;
+                }
+                break;
             case '?':
                 usage(name);
                 return EXIT_FAILURE;
@@ -2466,32 +5847,193 @@ int main(int argc, char *argv[]){
         }
     }
 
-    /*=========== read quadrangulations ===========*/
-    
-    unsigned short code[MAXCODELENGTH];
-    int length;
-    while (readPlanarCode(code, &length, stdin)) {
-        decodePlanarCode(code);
-        if(relabelInputQuadrangulation){
-            relabelQuadrangulation();
+    if(partitionModulus == 0 || partitionResidue >= partitionModulus){
+        fprintf(stderr, "The residue should be smaller than the modulus.\n");
+        usage(name);
+        return EXIT_FAILURE;
+    }
+
+    if(resumeFromCheckpoint && checkpointFileName == NULL){
+        fprintf(stderr, "--resume requires --checkpoint.\n");
+        usage(name);
+        return EXIT_FAILURE;
+    }
+
+    if(isBlockPartition && (offsetIndexFileName == NULL || splitDepth > 0)){
+        fprintf(stderr, "--blocks requires --index and can't be combined with --splitdepth.\n");
+        usage(name);
+        return EXIT_FAILURE;
+    }
+
+#ifdef PLANTRI_PLUGIN
+    if(processCount > 1 || checkpointFileName != NULL || offsetIndexFileName != NULL){
+        fprintf(stderr, "--procs, --checkpoint and --index can't be used in the plantri plugin.\n");
+        usage(name);
+        return EXIT_FAILURE;
+    }
+#endif
+
+    return CONTINUE_RUN;
+}
+
+void startRun(){
+    if(outputFileName != NULL){
+        //when resuming, the output file is truncated to its size at the checkpoint
+        if(freopen(outputFileName, resumeFromCheckpoint ? "r+" : "w", stdout) == NULL){
+            fprintf(stderr, "Could not open output file %s -- exiting!\n", outputFileName);
+            exit(1);
         }
-        numberOfQuadrangulations++;
-        if(filterOnly==0 || numberOfQuadrangulations==filterOnly){
-            if(!isEarlyFilteringEnabled || earlyFilterQuadrangulations()){
-                orderFaces();
-                generate_perfect_matchings_in_dual(); 
-            } else if(unusedQuadrangulations){
-                unusedGraphCount++;
-                outputQuadrangulation();
-            } else {
-                unusedGraphCount++;
-            }
+    }
+    //the output is written in large blocks
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    //the human-readable output only goes to stderr if stdout contains code
+    humanOutputFile = outputFormat == 'c' ? stderr : stdout;
+    
+    if(latexFileName != NULL){
+        //when resuming, the LaTeX file is truncated to its size at the checkpoint
+        latexSummaryFile = fopen(latexFileName, resumeFromCheckpoint ? "r+" : "w");
+        if(latexSummaryFile == NULL){
+            fprintf(stderr, "Could not open LaTeX file %s -- exiting!\n", latexFileName);
+            exit(1);
         }
     }
+
+    if(useFeasibilityCache && persistentCacheFileName != NULL){
+        openPersistentCache();
+    }
+    
+    selectEquationComparison();
+}
+
+void finishRun(){
     //close any possible open files
     if(latexSummaryFile != NULL){
         fclose(latexSummaryFile);
     }
+    closePersistentCache();
     printSummary();
+    if(summaryFileName != NULL){
+        writeSummaryFile();
+    }
+}
+
+#ifdef PLANTRI_PLUGIN
+
+/* The entry points for the plantri plugin stcq_plugin.c, which hands the
+ * quadrangulations generated by plantri directly to the search.
+ */
+
+void startPlugin(int argc, char *argv[]){
+    int status = parseOptions(argc, argv);
+    if(status != CONTINUE_RUN){
+        exit(status);
+    }
+    startRun();
+    if(threadCount > 1){
+        startWorkers();
+    }
+}
+
+/* Handles a quadrangulation with a BFS-labelling, of which the edges are
+ * given as in loadEmbedding().
+ */
+void handlePluginQuadrangulation(int vertexCount, int *degrees, int *ends, int *inverses){
+    numberOfQuadrangulations++;
+    updateInputVertexCount(vertexCount);
+    if(!isQuadrangulationSelected(numberOfQuadrangulations) ||
+            !isQuadrangulationInShare(numberOfQuadrangulations)){
+        return;
+    }
+    if(threadCount > 1){
+        //the workers need a copy of the quadrangulation
+        unsigned short code[MAXCODELENGTH];
+        int i, j, length = 0, edge = 0;
+        code[length++] = vertexCount;
+        for(i = 0; i < vertexCount; i++){
+            for(j = 0; j < degrees[i]; j++){
+                code[length++] = ends[edge++] + 1;
+            }
+            code[length++] = 0;
+        }
+        INPUT_STATE input;
+        getInputState(&input);
+        addJob(code, length, &input);
+    } else {
+        loadEmbedding(vertexCount, degrees, ends, inverses);
+        handleDecodedQuadrangulation(numberOfQuadrangulations);
+    }
+}
+
+/* Returns TRUE if the plugin can reject the quadrangulations with a cubic
+ * quadrangle itself, before they are passed to handlePluginQuadrangulation().
+ * These quadrangulations are rejected by earlyFilterQuadrangulations() and
+ * are not part of the output.
+ */
+boolean canRejectCubicQuadrangles(){
+    return isEarlyFilteringEnabled && onlyConvex && !unusedQuadrangulations;
+}
+
+/* Counts a quadrangulation that was rejected by the plugin.
+ */
+void rejectPluginQuadrangulation(int vertexCount){
+    numberOfQuadrangulations++;
+    updateInputVertexCount(vertexCount);
+    if(isQuadrangulationSelected(numberOfQuadrangulations) &&
+            isQuadrangulationInShare(numberOfQuadrangulations)){
+        unusedGraphCount++;
+    }
+}
+
+void finishPlugin(){
+    if(threadCount > 1){
+        stopWorkers();
+    }
+    finishRun();
+}
 
+#else
+
+int main(int argc, char *argv[]){
+    int status = parseOptions(argc, argv);
+    if(status != CONTINUE_RUN){
+        return status;
+    }
+    startRun();
+    if(offsetIndexFileName != NULL){
+        openOffsetIndex(stdin);
+    }
+
+    /*=========== read quadrangulations ===========*/
+    
+    if(checkpointFileName != NULL){
+        startCheckpoints();
+    }
+    if(processCount > 1){
+        processQuadrangulationsInProcesses(stdin);
+    } else if(threadCount > 1){
+        processQuadrangulationsInParallel(stdin);
+    } else {
+        unsigned short code[MAXCODELENGTH];
+        int length;
+        INPUT_STATE input;
+        COUNTERS counters;
+        while (readNextQuadrangulation(code, &length, stdin)) {
+            if(isQuadrangulationSelected(numberOfQuadrangulations) &&
+                    isQuadrangulationInShare(numberOfQuadrangulations)){
+                handleQuadrangulation(code, numberOfQuadrangulations);
+            }
+            if(checkpointDue){
+                getInputState(&input);
+                getCounters(&counters);
+                takeCheckpointIfDue(&input, &counters);
+            }
+        }
+    }
+    if(checkpointFileName != NULL){
+        finishCheckpoints();
+    }
+    finishRun();
+    return EXIT_SUCCESS;
 }
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Test for --checkpoint and --resume with -j and --procs. A run that is killed
+# after its first checkpoint is resumed, and then the output and the counters
+# have to be the same as those of an uninterrupted run.
+#
+# Run from the top directory with: make test
+
+cd "$(dirname "$0")/.." || exit 1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+./plantri -q 22 2>/dev/null > "$dir/q22.pc"
+
+# the feasibility caches are per thread, so their hits depend on the threads
+counters() {
+    grep -v "feasibility_cache\|split_depth" "$1"
+}
+
+./stcq -o c --usedquadrangulations --summary "$dir/expected.json" < "$dir/q22.pc" > "$dir/expected" 2> /dev/null
+counters "$dir/expected.json" > "$dir/expected_counters"
+
+status=0
+for options in "-j 2 --splitdepth 2" "--procs 2"; do
+    rm -f "$dir/checkpoint" "$dir/output"
+    ./stcq -o c --usedquadrangulations --checkpoint "$dir/checkpoint" --checkpointinterval 1 \
+            $options < "$dir/q22.pc" > "$dir/output" 2> /dev/null &
+    pid=$!
+    # the checkpoint is renamed into place once it is complete, so the run can
+    # be killed as soon as the file exists
+    while [ ! -f "$dir/checkpoint" ] && kill -0 $pid 2> /dev/null; do
+        sleep 1
+    done
+    kill -9 $pid 2> /dev/null
+    if wait $pid 2> /dev/null; then
+        echo "$options: the run was not killed"
+        status=1
+        continue
+    fi
+    ./stcq -o c --usedquadrangulations --checkpoint "$dir/checkpoint" --resume --summary "$dir/summary.json" \
+            $options < "$dir/q22.pc" >> "$dir/output" 2> /dev/null || { status=1; continue; }
+    if ! cmp -s "$dir/output" "$dir/expected"; then
+        echo "$options: the output after resuming differs"
+        status=1
+    fi
+    if ! counters "$dir/summary.json" | cmp -s - "$dir/expected_counters"; then
+        echo "$options: the counters after resuming differ"
+        status=1
+    fi
+done
+exit $status
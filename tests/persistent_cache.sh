@@ -0,0 +1,41 @@
+#!/bin/sh
+# Test for the persistent cache (--cachefile) with a writer that is killed
+# while appending a record. The records that are appended by later writers
+# have to be visible to all processes.
+#
+# Run from the top directory with: make test
+
+cd "$(dirname "$0")/.." || exit 1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# a writer that kills itself after taking the slot of its sixth record
+cc -o "$dir/stcq_killed" -O4 -pthread -DTEST_KILL_AT=5 stcq_sa.c || exit 1
+./plantri -q 16 2>/dev/null > "$dir/q16.pc"
+
+"$dir/stcq_killed" --cachefile "$dir/cache" < "$dir/q16.pc" > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+    echo "the writer was not killed"
+    exit 1
+fi
+
+counter() {
+    sed -n "s/^Persistent cache $1: //p" "$2"
+}
+
+./stcq -s --cachefile "$dir/cache" < "$dir/q16.pc" > /dev/null 2> "$dir/second"
+./stcq -s --cachefile "$dir/cache" < "$dir/q16.pc" > /dev/null 2> "$dir/third"
+
+loaded=$(counter "records loaded" "$dir/second")
+written=$(counter "records written" "$dir/second")
+if [ "$loaded" != 5 ] || [ "$written" = 0 ]; then
+    echo "second run: $loaded records loaded and $written written instead of 5 and more than 0"
+    exit 1
+fi
+if [ "$(counter "records loaded" "$dir/third")" != $((loaded + written)) ] ||
+        [ "$(counter "records written" "$dir/third")" != 0 ]; then
+    echo "third run: the records after the killed writer are not loaded"
+    exit 1
+fi
+exit 0
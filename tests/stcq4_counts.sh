@@ -0,0 +1,20 @@
+#!/bin/sh
+# Regression test for the number of spherical tilings by congruent
+# quadrangles of type 4 (stcq -4) for 8 to 20 vertices. The counts are those
+# after the c-edge check of checkSTCQ4Assignment() was made symmetric; before
+# that, e.g. 3 instead of 1 tiling was reported for 20 vertices.
+#
+# Run from the top directory with: make test
+
+cd "$(dirname "$0")/.." || exit 1
+
+status=0
+for expected in "8 1" "10 1" "12 1" "14 1" "16 1" "18 1" "20 1"; do
+    set -- $expected
+    count=$(./plantri -q $1 2>/dev/null | ./stcq -4 -s 2>&1 | sed -n 's/^Solvable and canonical: //p')
+    if [ "$count" != "$2" ]; then
+        echo "stcq -4 for $1 vertices: $count tilings instead of $2"
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,472 @@
+/* This program combines the summaries that are written by stcq with the
+ * --summary option for the parts of a run that was split with --res and
+ * --mod. It checks that the parts belong to the same run and that each part
+ * is present exactly once, and writes the summary of the complete run.
+ *
+ *
+ * Compile with:
+ *
+ *     cc -o stcq_merge -O4 stcq_merge.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#undef FALSE
+#undef TRUE
+#define FALSE 0
+#define TRUE 1
+
+typedef int boolean;
+
+#define MAXLINELENGTH 1000000
+
+struct list_el {
+    int key;
+    int value;
+    struct list_el * next;
+};
+
+typedef struct list_el item;
+
+typedef struct {
+    int version;
+    int vertices;
+    boolean concave;
+    boolean stcq4;
+    boolean mirror;
+    boolean interleaved;
+    boolean symmetryBreaking;
+    char *filter; //the list of -f, or the empty string
+    unsigned long long int res;
+    unsigned long long int mod;
+    boolean blocks;
+    int splitDepth;
+    unsigned long long int quadrangulations;
+    boolean hasUnusedQuadrangulations;
+    unsigned long long int unusedQuadrangulations;
+    unsigned long long int matchings;
+    unsigned long long int assignments;
+    unsigned long long int solvable;
+    unsigned long long int solvableAndCanonical;
+    unsigned long long int rejectedByCoefficientDiff;
+    unsigned long long int feasibilityCacheHits;
+    unsigned long long int feasibilityCacheMisses;
+    unsigned long long int persistentCacheHits;
+    unsigned long long int persistentCacheRecordsLoaded;
+    unsigned long long int persistentCacheRecordsWritten;
+    item *perfectMatchings;
+} SUMMARY;
+
+boolean textOutput = FALSE;
+
+char line[MAXLINELENGTH];
+
+//////////////////////////////////////////////////////////////////////////////
+
+item* incrementBy(item* head, int key, int amount) {
+    item *previousItem = NULL;
+    item *currentItem = head;
+    while (currentItem != NULL && currentItem->key < key) {
+        previousItem = currentItem;
+        currentItem = currentItem->next;
+    }
+    if (currentItem != NULL && currentItem->key == key) {
+        currentItem->value += amount;
+        return head;
+    }
+    item *new = (item *) malloc(sizeof (item));
+    new->key = key;
+    new->value = amount;
+    new->next = currentItem;
+    if (previousItem == NULL) {
+        return new;
+    }
+    previousItem->next = new;
+    return head;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void parseError(char *fileName, char *message){
+    fprintf(stderr, "Error in summary %s: %s -- exiting!\n", fileName, message);
+    exit(1);
+}
+
+boolean parseBoolean(char *fileName, char *value){
+    if(strncmp(value, "true", 4) == 0){
+        return TRUE;
+    } else if(strncmp(value, "false", 5) == 0){
+        return FALSE;
+    }
+    parseError(fileName, "boolean expected");
+    return FALSE;
+}
+
+/* Parses the filter, which is a string since version 2 and a number (0 if
+ * there was no filter) in version 1.
+ */
+char *parseFilter(char *fileName, char *value){
+    int length;
+    char *filter;
+
+    if(*value == '"'){
+        value++;
+        length = strcspn(value, "\"");
+        if(value[length] != '"'){
+            parseError(fileName, "malformed filter");
+        }
+    } else if(strtoull(value, NULL, 10) == 0){
+        length = 0;
+    } else {
+        length = strspn(value, "0123456789");
+    }
+    filter = (char *) malloc(length + 1);
+    memcpy(filter, value, length);
+    filter[length] = '\0';
+    return filter;
+}
+
+item *parsePerfectMatchings(char *fileName, char *value){
+    item *head = NULL;
+    int key, count, length;
+
+    if(*value != '['){
+        parseError(fileName, "array expected");
+    }
+    value++;
+    while(sscanf(value, " [%d , %d ]%n", &key, &count, &length) == 2){
+        head = incrementBy(head, key, count);
+        value += length;
+        while(*value == ',' || *value == ' ') value++;
+    }
+    if(*value != ']'){
+        parseError(fileName, "malformed perfect matchings");
+    }
+    return head;
+}
+
+/* Reads a summary that was written by writeSummaryFile() in stcq_sa.c: one
+ * member per line.
+ */
+void readSummary(char *fileName, SUMMARY *summary){
+    char key[100];
+    int valuePosition;
+    boolean isSummary = FALSE;
+    int memberCount = 0;
+
+    FILE *f = fopen(fileName, "r");
+    if(f == NULL){
+        fprintf(stderr, "Could not open summary %s -- exiting!\n", fileName);
+        exit(1);
+    }
+    memset(summary, 0, sizeof(SUMMARY));
+    while(fgets(line, MAXLINELENGTH, f) != NULL){
+        if(sscanf(line, " \"%99[^\"]\" : %n", key, &valuePosition) != 1){
+            continue;
+        }
+        char *value = line + valuePosition;
+        memberCount++;
+        if(strcmp(key, "format") == 0){
+            isSummary = strncmp(value, "\"stcq_summary\"", 14) == 0;
+        } else if(strcmp(key, "version") == 0){
+            summary->version = atoi(value);
+        } else if(strcmp(key, "vertices") == 0){
+            summary->vertices = atoi(value);
+        } else if(strcmp(key, "concave") == 0){
+            summary->concave = parseBoolean(fileName, value);
+        } else if(strcmp(key, "stcq4") == 0){
+            summary->stcq4 = parseBoolean(fileName, value);
+        } else if(strcmp(key, "mirror") == 0){
+            summary->mirror = parseBoolean(fileName, value);
+        } else if(strcmp(key, "interleaved") == 0){
+            summary->interleaved = parseBoolean(fileName, value);
+        } else if(strcmp(key, "symmetry_breaking") == 0){
+            summary->symmetryBreaking = parseBoolean(fileName, value);
+        } else if(strcmp(key, "filter") == 0){
+            summary->filter = parseFilter(fileName, value);
+        } else if(strcmp(key, "res") == 0){
+            summary->res = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "mod") == 0){
+            summary->mod = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "blocks") == 0){
+            summary->blocks = parseBoolean(fileName, value);
+        } else if(strcmp(key, "split_depth") == 0){
+            summary->splitDepth = atoi(value);
+        } else if(strcmp(key, "quadrangulations") == 0){
+            summary->quadrangulations = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "unused_quadrangulations") == 0){
+            summary->hasUnusedQuadrangulations = TRUE;
+            summary->unusedQuadrangulations = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "matchings") == 0){
+            summary->matchings = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "assignments") == 0){
+            summary->assignments = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "solvable") == 0){
+            summary->solvable = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "solvable_and_canonical") == 0){
+            summary->solvableAndCanonical = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "rejected_by_coefficient_diff") == 0){
+            summary->rejectedByCoefficientDiff = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "feasibility_cache_hits") == 0){
+            summary->feasibilityCacheHits = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "feasibility_cache_misses") == 0){
+            summary->feasibilityCacheMisses = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_hits") == 0){
+            summary->persistentCacheHits = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_records_loaded") == 0){
+            summary->persistentCacheRecordsLoaded = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "persistent_cache_records_written") == 0){
+            summary->persistentCacheRecordsWritten = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "perfect_matchings") == 0){
+            summary->perfectMatchings = parsePerfectMatchings(fileName, value);
+        } else {
+            memberCount--;
+        }
+    }
+    fclose(f);
+    if(!isSummary){
+        parseError(fileName, "not an stcq summary");
+    }
+    if(summary->version != 1 && summary->version != 2){
+        parseError(fileName, "unsupported version");
+    }
+    if(summary->filter == NULL){
+        summary->filter = "";
+    }
+    if(summary->mod == 0 || summary->res >= summary->mod){
+        parseError(fileName, "invalid res and mod");
+    }
+}
+
+/* Returns TRUE if the counters of the unused quadrangulations and the perfect
+ * matchings of the parts add up. This is not the case if the subtrees of the
+ * search were split instead of the quadrangulations.
+ */
+boolean isSplitByQuadrangulation(SUMMARY *summary){
+    return summary->mod == 1 || summary->splitDepth == 0;
+}
+
+void checkCompatible(char *fileName, SUMMARY *first, SUMMARY *summary){
+    if(summary->vertices != first->vertices){
+        parseError(fileName, "different number of vertices");
+    }
+    if(summary->concave != first->concave || summary->stcq4 != first->stcq4 ||
+            summary->mirror != first->mirror || summary->interleaved != first->interleaved ||
+            summary->symmetryBreaking != first->symmetryBreaking || strcmp(summary->filter, first->filter) != 0){
+        parseError(fileName, "different options");
+    }
+    if(summary->mod != first->mod || summary->splitDepth != first->splitDepth ||
+            summary->blocks != first->blocks){
+        parseError(fileName, "different partitioning");
+    }
+    if(summary->quadrangulations != first->quadrangulations){
+        parseError(fileName, "different number of quadrangulations in the input");
+    }
+}
+
+void addSummary(SUMMARY *total, SUMMARY *summary){
+    item *currentItem;
+    total->unusedQuadrangulations += summary->unusedQuadrangulations;
+    total->matchings += summary->matchings;
+    total->assignments += summary->assignments;
+    total->solvable += summary->solvable;
+    total->solvableAndCanonical += summary->solvableAndCanonical;
+    total->rejectedByCoefficientDiff += summary->rejectedByCoefficientDiff;
+    total->feasibilityCacheHits += summary->feasibilityCacheHits;
+    total->feasibilityCacheMisses += summary->feasibilityCacheMisses;
+    total->persistentCacheHits += summary->persistentCacheHits;
+    total->persistentCacheRecordsLoaded += summary->persistentCacheRecordsLoaded;
+    total->persistentCacheRecordsWritten += summary->persistentCacheRecordsWritten;
+    for(currentItem = summary->perfectMatchings; currentItem != NULL; currentItem = currentItem->next){
+        total->perfectMatchings = incrementBy(total->perfectMatchings, currentItem->key, currentItem->value);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void writeSummary(FILE *f, SUMMARY *summary){
+    item *currentItem;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"format\": \"stcq_summary\",\n");
+    fprintf(f, "  \"version\": 2,\n");
+    fprintf(f, "  \"vertices\": %d,\n", summary->vertices);
+    fprintf(f, "  \"concave\": %s,\n", summary->concave ? "true" : "false");
+    fprintf(f, "  \"stcq4\": %s,\n", summary->stcq4 ? "true" : "false");
+    fprintf(f, "  \"mirror\": %s,\n", summary->mirror ? "true" : "false");
+    fprintf(f, "  \"interleaved\": %s,\n", summary->interleaved ? "true" : "false");
+    fprintf(f, "  \"symmetry_breaking\": %s,\n", summary->symmetryBreaking ? "true" : "false");
+    fprintf(f, "  \"filter\": \"%s\",\n", summary->filter);
+    fprintf(f, "  \"res\": %llu,\n", summary->res);
+    fprintf(f, "  \"mod\": %llu,\n", summary->mod);
+    fprintf(f, "  \"blocks\": %s,\n", summary->blocks ? "true" : "false");
+    fprintf(f, "  \"split_depth\": %d,\n", summary->splitDepth);
+    fprintf(f, "  \"quadrangulations\": %llu,\n", summary->quadrangulations);
+    if(summary->hasUnusedQuadrangulations){
+        fprintf(f, "  \"unused_quadrangulations\": %llu,\n", summary->unusedQuadrangulations);
+    }
+    fprintf(f, "  \"matchings\": %llu,\n", summary->matchings);
+    fprintf(f, "  \"assignments\": %llu,\n", summary->assignments);
+    fprintf(f, "  \"solvable\": %llu,\n", summary->solvable);
+    fprintf(f, "  \"solvable_and_canonical\": %llu,\n", summary->solvableAndCanonical);
+    fprintf(f, "  \"rejected_by_coefficient_diff\": %llu,\n", summary->rejectedByCoefficientDiff);
+    fprintf(f, "  \"feasibility_cache_hits\": %llu,\n", summary->feasibilityCacheHits);
+    fprintf(f, "  \"feasibility_cache_misses\": %llu,\n", summary->feasibilityCacheMisses);
+    fprintf(f, "  \"persistent_cache_hits\": %llu,\n", summary->persistentCacheHits);
+    fprintf(f, "  \"persistent_cache_records_loaded\": %llu,\n", summary->persistentCacheRecordsLoaded);
+    fprintf(f, "  \"persistent_cache_records_written\": %llu,\n", summary->persistentCacheRecordsWritten);
+    fprintf(f, "  \"perfect_matchings\": [");
+    for(currentItem = summary->perfectMatchings; currentItem != NULL; currentItem = currentItem->next){
+        fprintf(f, "[%d, %d]%s", currentItem->key, currentItem->value,
+                currentItem->next == NULL ? "" : ", ");
+    }
+    fprintf(f, "]\n");
+    fprintf(f, "}\n");
+}
+
+/* Prints the summary in the same way as printSummary() in stcq_sa.c with the
+ * option -s.
+ */
+void printSummary(FILE *f, SUMMARY *summary){
+    item *currentItem;
+    if (!summary->interleaved && summary->perfectMatchings != NULL) {
+        fprintf(f, "Size   Count\n");
+        fprintf(f, "------------\n");
+        for(currentItem = summary->perfectMatchings; currentItem != NULL; currentItem = currentItem->next){
+            fprintf(f, "%4d : %5d\n", currentItem->key, currentItem->value);
+        }
+    }
+    fprintf(f, "\nQuadrangulations: %llu\n", summary->quadrangulations);
+    if(strpbrk(summary->filter, ",-") != NULL){
+        fprintf(f, "Only quadrangulations %s were used\n", summary->filter);
+    } else if(*summary->filter){
+        fprintf(f, "Only quadrangulation %s was used\n", summary->filter);
+    }
+    if (!summary->interleaved) {
+        fprintf(f, "\nMatchings: %llu\n", summary->matchings);
+    }
+    fprintf(f, "\nAssignments: %llu\n", summary->assignments);
+    fprintf(f, "\nSolvable: %llu\n", summary->solvable);
+    fprintf(f, "\nSolvable and canonical: %llu\n", summary->solvableAndCanonical);
+    fprintf(f, "\nNon-solvable: %llu\n", summary->assignments - summary->solvable);
+    if(summary->hasUnusedQuadrangulations){
+        fprintf(f, "\n%llu quadrangulations do not correspond to a tiling.\n", summary->unusedQuadrangulations);
+        fprintf(f, "%llu quadrangulations can correspond to a tiling.\n", summary->quadrangulations - summary->unusedQuadrangulations);
+    }
+    fprintf(f, "\nRejected by coefficient diff: %llu\n", summary->rejectedByCoefficientDiff);
+    fprintf(f, "Rejected by exact solver: %llu\n\n", summary->assignments - summary->solvable - summary->rejectedByCoefficientDiff);
+    fprintf(f, "Feasibility cache hits: %llu\n", summary->feasibilityCacheHits);
+    fprintf(f, "Feasibility cache misses: %llu\n\n", summary->feasibilityCacheMisses);
+    fprintf(f, "Persistent cache hits: %llu\n", summary->persistentCacheHits);
+    fprintf(f, "Persistent cache records loaded: %llu\n", summary->persistentCacheRecordsLoaded);
+    fprintf(f, "Persistent cache records written: %llu\n\n", summary->persistentCacheRecordsWritten);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void help(char *name){
+    fprintf(stderr, "The program %s combines the summaries of the parts of a split stcq run.\n\n", name);
+    fprintf(stderr, "Usage\n=====\n");
+    fprintf(stderr, " %s [options] summary ...\n\n", name);
+    fprintf(stderr, "Each summary is a file written by stcq --summary. Together the summaries\n");
+    fprintf(stderr, "should contain each part of a run with --res and --mod exactly once. The\n");
+    fprintf(stderr, "combined summary is written to stdout.\n\n");
+    fprintf(stderr, "Valid options\n=============\n");
+    fprintf(stderr, "    -h, --help\n");
+    fprintf(stderr, "       Print this help and return.\n");
+    fprintf(stderr, "    -t, --text\n");
+    fprintf(stderr, "       Print the combined summary as text instead of JSON.\n");
+}
+
+void usage(char *name){
+    fprintf(stderr, "Usage: %s [options] summary ...\n", name);
+    fprintf(stderr, "For more information type: %s -h \n\n", name);
+}
+
+int main(int argc, char *argv[]){
+    /*=========== commandline parsing ===========*/
+
+    int c;
+    char *name = argv[0];
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"text", no_argument, NULL, 't'},
+        {0, 0, 0, 0}
+    };
+    int option_index = 0;
+
+    while ((c = getopt_long(argc, argv, "ht", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'h':
+                help(name);
+                return EXIT_SUCCESS;
+            case 't':
+                textOutput = TRUE;
+                break;
+            case '?':
+                usage(name);
+                return EXIT_FAILURE;
+            default:
+                fprintf(stderr, "Illegal option %c.\n", c);
+                usage(name);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind == argc){
+        usage(name);
+        return EXIT_FAILURE;
+    }
+
+    /*=========== read and combine the summaries ===========*/
+
+    SUMMARY total, summary;
+    int i;
+
+    readSummary(argv[optind], &total);
+    if(total.mod > argc - optind){
+        fprintf(stderr, "Only %d of the %llu parts are given -- exiting!\n", argc - optind, total.mod);
+        return EXIT_FAILURE;
+    }
+
+    boolean *isPartPresent = (boolean *) calloc(total.mod, sizeof(boolean));
+    isPartPresent[total.res] = TRUE;
+
+    for(i = optind + 1; i < argc; i++){
+        readSummary(argv[i], &summary);
+        checkCompatible(argv[i], &total, &summary);
+        if(isPartPresent[summary.res]){
+            parseError(argv[i], "part is given more than once");
+        }
+        isPartPresent[summary.res] = TRUE;
+        addSummary(&total, &summary);
+    }
+
+    for(i = 0; i < total.mod; i++){
+        if(!isPartPresent[i]){
+            fprintf(stderr, "Part %d of %llu is missing -- exiting!\n", i, total.mod);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(!isSplitByQuadrangulation(&total)){
+        //the quadrangulations and their matchings are spread over the parts
+        fprintf(stderr, "The subtrees were split: the unused quadrangulations and the perfect matchings\n");
+        fprintf(stderr, "histogram can't be combined and are omitted.\n");
+        total.hasUnusedQuadrangulations = FALSE;
+        total.perfectMatchings = NULL;
+    }
+    total.res = 0;
+    total.mod = 1;
+    total.blocks = FALSE;
+
+    if(textOutput){
+        printSummary(stdout, &total);
+    } else {
+        writeSummary(stdout, &total);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -11,6 +11,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef MAXN
 #define MAXN 64 /* the maximum number of vertices */
@@ -39,8 +43,7 @@ note: only valid if make_dual() called */
     struct e *prev; /* previous edge in clockwise direction */
     struct e *next; /* next edge in clockwise direction */
     struct e *inverse; /* the edge that is inverse to this one */
-    int mark,index; /* two ints for temporary use;
-Only access mark via the MARK macros. */
+    int index; /* int for temporary use */
 
     int left_facesize; /* size of the face in prev-direction of the edge.
 Only used for -p option. */
@@ -54,18 +57,6 @@ int faceSize[MAXF]; /* pointer to arbitrary edge of face i. */
 
 EDGE edges[MAXE];
 
-static int markvalue = 30000;
-#define RESETMARKS {int mki; if ((markvalue += 2) > 30000) \
-{ markvalue = 2; for (mki=0;mki<MAXE;++mki) edges[mki].mark=0;}}
-#define MARK(e) (e)->mark = markvalue
-#define MARKLO(e) (e)->mark = markvalue
-#define MARKHI(e) (e)->mark = markvalue+1
-#define UNMARK(e) (e)->mark = markvalue-1
-#define ISMARKED(e) ((e)->mark >= markvalue)
-#define ISMARKEDLO(e) ((e)->mark == markvalue)
-#define ISMARKEDHI(e) ((e)->mark > markvalue)
-
-
 unsigned long long int numberOfGraphs = 0;
 unsigned long long int numberOfGraphsWithSubstructure = 0;
 
@@ -359,46 +350,30 @@ void printPlanarGraph(){
     }
 }
 
-EDGE *findEdge(int from, int to){
-    EDGE *e, *elast;
-    
-    e = elast = firstedge[from];
-    do {
-        if(e->end==to){
-            return e;
-        }
-        e = e->next;
-    } while (e!=elast);
-    fprintf(stderr, "error while looking for edge from %d to %d.\n", from, to);
-    exit(0);
-}
-
  
 /* Store in the rightface field of each edge the number of the face on
 the right hand side of that edge. Faces are numbered 0,1,.... Also
 store in facestart[i] an example of an edge in the clockwise orientation
 of the face boundary, and the size of the face in facesize[i], for each i.
-Returns the number of faces. */
+The rightface of each edge has to be -1 when this is called: it marks the
+edges of which the face isn't known yet. */
 void makeDual(){
     register int i,sz;
     register EDGE *e,*ex,*ef,*efx;
  
-    RESETMARKS;
- 
     nf = 0;
     for (i = 0; i < nv; ++i){
 
         e = ex = firstedge[i];
         do
         {
-            if (!ISMARKEDLO(e))
+            if (e->rightface < 0)
             {
                 facestart[nf] = ef = efx = e;
                 sz = 0;
                 do
                 {
                     ef->rightface = nf;
-                    MARKLO(ef);
                     ef = ef->inverse->prev;
                     ++sz;
                 } while (ef != efx);
@@ -410,49 +385,68 @@ void makeDual(){
     }
 }
 
+/* Decodes the planar code in time linear in its length. The edges from a
+vertex to a vertex with a larger number are put in a list for the larger
+vertex, linked by their inverse field. Before a vertex is decoded, the edges
+in its list are stored in edgeFromNeighbour by their start, so the inverse
+of each edge to a smaller vertex is found at once. Input that is not a
+valid embedding is rejected. */
 void decodePlanarCode(unsigned short* code) {
-    /* complexity of method to determine inverse isn't that good, but will have to satisfy for now
-*/
-    int i, j, codePosition;
-    int edgeCounter = 0;
-    EDGE *inverse;
+    int i, j, neighbour, codePosition;
+    int edgeCounter = 0, inverseCount = 0;
+    EDGE *e, *inverse;
+    EDGE *edgesFromSmallerVertices[MAXN];
+    EDGE *edgeFromNeighbour[MAXN];
 
     nv = code[0];
     codePosition = 1;
 
     for (i = 0; i < nv; i++) {
-        degree[i] = 0;
-        firstedge[i] = edges + edgeCounter;
-        edges[edgeCounter].start = i;
-        edges[edgeCounter].end = code[codePosition] - 1;
-        edges[edgeCounter].next = edges + edgeCounter + 1;
-        if(code[codePosition] - 1 < i){
-            inverse = findEdge(code[codePosition]-1, i);
-            edges[edgeCounter].inverse = inverse;
-            inverse->inverse = edges + edgeCounter;
-        } else {
-            edges[edgeCounter].inverse = NULL;
+        edgesFromSmallerVertices[i] = edgeFromNeighbour[i] = NULL;
+    }
+
+    for (i = 0; i < nv; i++) {
+        for (e = edgesFromSmallerVertices[i]; e != NULL; e = e->inverse) {
+            edgeFromNeighbour[e->start] = e;
         }
-        edgeCounter++;
-        codePosition++;
-        for (j = 1; code[codePosition]; j++, codePosition++) {
+        firstedge[i] = edges + edgeCounter;
+        for (j = 0; code[codePosition]; j++, codePosition++) {
             if (j == MAXVAL) {
                 fprintf(stderr, "MAXVAL too small: %d\n", MAXVAL);
                 exit(0);
             }
-            edges[edgeCounter].start = i;
-            edges[edgeCounter].end = code[codePosition] - 1;
-            edges[edgeCounter].prev = edges + edgeCounter - 1;
-            edges[edgeCounter].next = edges + edgeCounter + 1;
-            if(code[codePosition] - 1 < i){
-                inverse = findEdge(code[codePosition]-1, i);
-                edges[edgeCounter].inverse = inverse;
-                inverse->inverse = edges + edgeCounter;
+            neighbour = code[codePosition] - 1;
+            if (neighbour >= nv || neighbour == i) {
+                fprintf(stderr, "Invalid planar code: vertex %d has neighbour %d -- exiting!\n", i + 1, neighbour + 1);
+                exit(1);
+            }
+            e = edges + edgeCounter;
+            e->start = i;
+            e->end = neighbour;
+            e->prev = e - 1;
+            e->next = e + 1;
+            e->rightface = -1;
+            if (neighbour < i) {
+                inverse = edgeFromNeighbour[neighbour];
+                //an edge that is left from an earlier vertex doesn't end in i
+                if (inverse == NULL || inverse->end != i) {
+                    fprintf(stderr, "Invalid planar code: no edge from %d to %d -- exiting!\n", neighbour + 1, i + 1);
+                    exit(1);
+                }
+                edgeFromNeighbour[neighbour] = NULL;
+                e->inverse = inverse;
+                inverse->inverse = e;
+                inverseCount++;
             } else {
-                edges[edgeCounter].inverse = NULL;
+                e->inverse = edgesFromSmallerVertices[neighbour];
+                edgesFromSmallerVertices[neighbour] = e;
             }
             edgeCounter++;
         }
+        if (j == 0) {
+            fprintf(stderr, "Invalid planar code: vertex %d has no neighbours -- exiting!\n", i + 1);
+            exit(1);
+        }
         firstedge[i]->prev = edges + edgeCounter - 1;
         edges[edgeCounter-1].next = firstedge[i];
         degree[i] = j;
@@ -460,7 +454,97 @@ void decodePlanarCode(unsigned short* code) {
         codePosition++; /* read the closing 0 */
     }
     
+    if (2*inverseCount != edgeCounter) {
+        fprintf(stderr, "Invalid planar code: not every edge has an inverse edge -- exiting!\n");
+        exit(1);
+    }
+    
     makeDual();
+    
+    if (nv - edgeCounter/2 + nf != 2) {
+        fprintf(stderr, "Invalid planar code: the embedding is not planar -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* The input is read in large blocks instead of byte by byte: a regular file
+* is mapped in memory as a whole, other input is read in blocks of
+* INPUT_BLOCK_SIZE bytes. inputIndex is the next byte to be parsed.
+*/
+#define INPUT_BLOCK_SIZE (4*1024*1024)
+
+FILE *inputFile = NULL;
+unsigned char *inputData = NULL;
+size_t inputDataLength = 0;
+size_t inputIndex = 0;
+int isInputMapped = FALSE;
+
+void openInput(FILE *file) {
+    struct stat fileStatus;
+    long offset = ftell(file);
+
+    inputFile = file;
+    if (offset < 0) offset = 0;
+    if (fstat(fileno(file), &fileStatus) == 0 && S_ISREG(fileStatus.st_mode) &&
+            fileStatus.st_size > offset) {
+        void *data = mmap(NULL, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (data != MAP_FAILED) {
+            madvise(data, fileStatus.st_size, MADV_SEQUENTIAL);
+            inputData = data;
+            inputDataLength = fileStatus.st_size;
+            inputIndex = offset;
+            isInputMapped = TRUE;
+            return;
+        }
+    }
+    inputData = (unsigned char *) malloc(INPUT_BLOCK_SIZE);
+    if (inputData == NULL) {
+        fprintf(stderr, "Insufficient memory for the input -- exiting!\n");
+        exit(1);
+    }
+}
+
+/* Reads the next block of the input after the bytes that are not parsed yet.
+* Returns 0 at the end of the input.
+*/
+int readInputBlock() {
+    size_t remaining = inputDataLength - inputIndex;
+    ssize_t size;
+
+    if (isInputMapped) return 0;
+    memmove(inputData, inputData + inputIndex, remaining);
+    inputIndex = 0;
+    inputDataLength = remaining;
+    do {
+        size = read(fileno(inputFile), inputData + remaining, INPUT_BLOCK_SIZE - remaining);
+    } while (size < 0 && errno == EINTR);
+    if (size < 0) {
+        fprintf(stderr, "Error while reading the input -- exiting!\n");
+        exit(1);
+    }
+    inputDataLength += size;
+    return size > 0;
+}
+
+/* Returns 1 if the next count bytes of the input are in inputData. */
+int isInputAvailable(size_t count) {
+    while (inputDataLength - inputIndex < count) {
+        if (!readInputBlock()) return 0;
+    }
+    return 1;
+}
+
+int readInputByte() {
+    if (inputIndex == inputDataLength && !readInputBlock()) return EOF;
+    return inputData[inputIndex++];
+}
+
+/* Reads an unsigned short in the byte order of this machine. */
+int readInputShort(unsigned short *value) {
+    if (!isInputAvailable(sizeof (unsigned short))) return 0;
+    memcpy(value, inputData + inputIndex, sizeof (unsigned short));
+    inputIndex += sizeof (unsigned short);
+    return 1;
 }
 
 /**
@@ -471,22 +555,25 @@ void decodePlanarCode(unsigned short* code) {
 * @return returns 1 if a code was read and 0 otherwise. Exits in case of error.
 */
 int readPlanarCode(unsigned short code[], int *length, FILE *file) {
-    static int first = 1;
-    unsigned char c;
+    int c;
     char testheader[20];
     int bufferSize, zeroCounter;
+    int i;
 
 
-    if (first) {
-        first = 0;
+    if (inputFile == NULL) {
+        openInput(file);
 
-        if (fread(&testheader, sizeof (unsigned char), 15, file) != 15) {
+        for (i = 0; i < 15 && (c = readInputByte()) != EOF; i++) {
+            testheader[i] = c;
+        }
+        if (i != 15) {
             fprintf(stderr, "can't read header ((1)file too small)-- exiting\n");
             exit(1);
         }
         testheader[15] = 0;
         if (strcmp(testheader, ">>planar_code<<") == 0) {
-            
+
         } else {
             fprintf(stderr, "No planarcode header detected -- exiting!\n");
             exit(1);
@@ -494,42 +581,29 @@ int readPlanarCode(unsigned short code[], int *length, FILE *file) {
     }
 
     /* possibly removing interior headers -- only done for planarcode */
-    if (fread(&c, sizeof (unsigned char), 1, file) == 0){
+    if ((c = readInputByte()) == EOF) {
         //nothing left in file
         return (0);
     }
-    
-    if (c == '>'){
+
+    if (c == '>' && isInputAvailable(2) &&
+            inputData[inputIndex] == '>' && inputData[inputIndex + 1] == 'p') {
         // could be a header, or maybe just a 62 (which is also possible for unsigned char
-        code[0] = c;
-        bufferSize = 1;
-        zeroCounter = 0;
-        code[1] = (unsigned short) getc(file);
-        if (code[1] == 0) zeroCounter++;
-        code[2] = (unsigned short) getc(file);
-        if (code[2] == 0) zeroCounter++;
-        bufferSize = 3;
-        // 3 characters were read and stored in buffer
-        if ((code[1] == '>') && (code[2] == 'p')) /*we are sure that we're dealing with a header*/ {
-            while ((c = getc(file)) != '<');
-            /* read 2 more characters: */
-            c = getc(file);
-            if (c != '<') {
-                fprintf(stderr, "Problems with header -- single '<'\n");
-                exit(1);
-            }
-            if (!fread(&c, sizeof (unsigned char), 1, file)){
-                //nothing left in file
-                return (0);
-            }
-            bufferSize = 1;
-            zeroCounter = 0;
+        /*we are sure that we're dealing with a header*/
+        while ((c = readInputByte()) != '<' && c != EOF);
+        /* read 2 more characters: */
+        c = readInputByte();
+        if (c != '<') {
+            fprintf(stderr, "Problems with header -- single '<'\n");
+            exit(1);
+        }
+        if ((c = readInputByte()) == EOF) {
+            //nothing left in file
+            return (0);
         }
-    } else {
-        //no header present
-        bufferSize = 1;
-        zeroCounter = 0;
     }
+    bufferSize = 1;
+    zeroCounter = 0;
 
     if (c != 0) /* unsigned chars would be sufficient */ {
         code[0] = c;
@@ -538,20 +612,28 @@ int readPlanarCode(unsigned short code[], int *length, FILE *file) {
             exit(1);
         }
         while (zeroCounter < code[0]) {
-            code[bufferSize] = (unsigned short) getc(file);
+            if ((c = readInputByte()) == EOF) {
+                fprintf(stderr, "Unexpected EOF.\n");
+                exit(1);
+            }
+            code[bufferSize] = c;
             if (code[bufferSize] == 0) zeroCounter++;
             bufferSize++;
         }
     } else {
-        fread(code, sizeof (unsigned short), 1, file);
+        if (!readInputShort(code)) {
+            fprintf(stderr, "Unexpected EOF.\n");
+            exit(1);
+        }
         if (code[0] > MAXN) {
             fprintf(stderr, "Constant N too small %d > %d \n", code[0], MAXN);
             exit(1);
         }
-        bufferSize = 1;
-        zeroCounter = 0;
         while (zeroCounter < code[0]) {
-            fread(code + bufferSize, sizeof (unsigned short), 1, file);
+            if (!readInputShort(code + bufferSize)) {
+                fprintf(stderr, "Unexpected EOF.\n");
+                exit(1);
+            }
             if (code[bufferSize] == 0) zeroCounter++;
             bufferSize++;
         }